@@ -0,0 +1,44 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define MD5_IOCTL_MAGIC 0xFC
+
+#define MD5_SET_MODE _IO(MD5_IOCTL_MAGIC, 0)   // argument is a MD5_MODE_* value
+
+#define MD5_MODE_MESSAGE  0 // a write() or writev() is one message (default)
+#define MD5_MODE_SEGMENTS 1 // every writev() segment is a message, its digests are read in order
+
+#define MD5_IOCTL_MAXNR 0
+
+// io_uring commands (IORING_OP_URING_CMD 'cmd_op'), the SQE command area
+// holds a struct md5_uring_cmd
+#define MD5_URING_HASH 0    // hash every message of a batch, the CQE result is the number of digests
+
+struct md5_batch {
+    __u64 buf;          // message
+    __u64 len;          // message bytes
+    __u8 digest[16];    // filled with the message digest
+};
+
+struct md5_uring_cmd {
+    __u64 entries;      // array of struct md5_batch
+    __u32 nr;           // entries on the array
+    __u32 flags;        // must be 0
+};
+
+#define MD5_BATCH_MAX 1024  // biggest batch
@@ -0,0 +1,98 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define STACK_IOCTL_MAGIC  0xFE
+
+/**
+ * Digest request, hashes the top 'len' bytes of the stack in place.
+ */
+struct stack_digest {
+    __u64 len;          ///< in: bytes from top (0 = whole stack), out: bytes hashed
+    __u8  digest[16];   ///< out: md5 of the bytes, bottom to top order
+};
+
+/**
+ * Peek request, copies up to 'len' bytes lying 'depth' bytes below the top
+ * of the stack. Same data pread(fd, buf, len, depth) returns.
+ */
+struct stack_peek {
+    __u64 buf;          ///< user buffer address
+    __u64 len;          ///< in: buffer size, out: bytes copied
+    __u64 depth;        ///< bytes to skip from the top
+};
+
+/**
+ * Transfer request, moves the top 'len' bytes of the stack on top of the
+ * stack opened as 'fd', keeping their order.
+ */
+struct stack_xfer {
+    __s32 fd;           ///< destination stack file descriptor
+    __u32 flags;        ///< STACK_XFER_* flags
+    __u64 len;          ///< in: bytes from top (0 = whole stack), out: bytes transferred
+};
+
+#define STACK_XFER_COPY 0x1 // leave the source stack untouched
+
+/**
+ * Cold data counters, see the 'cold_depth' module parameter.
+ */
+struct stack_cold_stats {
+    __u64 raw_bytes;    ///< bytes currently compressed
+    __u64 packed_bytes; ///< memory they take
+    __u64 chunks;       ///< chunks currently compressed
+    __u64 frozen;       ///< bytes ever compressed
+    __u64 thawed;       ///< bytes ever uncompressed back to the buffer
+    __u64 freeze_ns;    ///< time spent compressing
+    __u64 thaw_ns;      ///< time spent uncompressing
+};
+
+#define STACK_DIGEST    _IOWR(STACK_IOCTL_MAGIC, 0, struct stack_digest)
+#define STACK_PEEK      _IOWR(STACK_IOCTL_MAGIC, 1, struct stack_peek)
+#define STACK_XFER      _IOWR(STACK_IOCTL_MAGIC, 2, struct stack_xfer)
+#define STACK_SET_LIMIT _IOW(STACK_IOCTL_MAGIC, 3, __u64)   // max bytes on the stack, 0 = no limit
+#define STACK_COLD_STATS _IOR(STACK_IOCTL_MAGIC, 4, struct stack_cold_stats)
+#define STACK_SET_BACKING _IO(STACK_IOCTL_MAGIC, 5)         // argument is a STACK_BACKING_* value
+
+#define STACK_BACKING_KMEM  0   // kernel memory buffer (default)
+#define STACK_BACKING_SHMEM 1   // swappable shmem pages
+
+#define STACK_SET_COALESCE _IO(STACK_IOCTL_MAGIC, 6)        // argument is the staging buffer size, 0 disables it
+
+#define STACK_COALESCE_MAX (1 << 20)    // biggest staging buffer
+
+#define STACK_IOCTL_MAXNR 6
+
+// io_uring commands (IORING_OP_URING_CMD 'cmd_op'), the SQE command area
+// holds a struct stack_uring_cmd and the CQE result is like read()/write()
+#define STACK_URING_PUSH 0  // push 'len' bytes from 'addr'
+#define STACK_URING_POP  1  // pop up to 'len' bytes to 'addr'
+#define STACK_URING_PEEK 2  // copy up to 'len' bytes 'depth' bytes below the top to 'addr'
+
+struct stack_uring_cmd {
+    __u64 addr;     // user buffer
+    __u32 len;      // buffer bytes
+    __u32 depth;    // STACK_URING_PEEK only
+};
+
+// /dev/mpc-control commands
+#define STACK_CTL_MAGIC  0xFD
+
+#define STACK_CTL_CREATE    _IO(STACK_CTL_MAGIC, 0)  // returns the new stack index
+#define STACK_CTL_DESTROY   _IO(STACK_CTL_MAGIC, 1)  // argument is the stack index
+
+#define STACK_CTL_MAXNR 1
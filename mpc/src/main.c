@@ -41,6 +41,8 @@ static int mpc_dev_uevent(struct device *dev, struct kobj_uevent_env *env) {
  * Driver cleanup
  */
 static void mpc_cleanup(void) {
+    mpc_stats_cleanup();
+
     if (mpc_class) {
         mpc_stack_cleanup(mpc_class);
         mpc_md5_cleanup(mpc_class);
@@ -60,7 +62,7 @@ static void mpc_cleanup(void) {
 static int __init mpc_init_driver(void) {
     dev_t firstdev = 0, dev;
 
-    // n (stacks) + 1 (md5) + 1 (rtc)
+    // n (stacks + control) + 1 (md5) + 1 (rtc)
     mpc_ndevs = mpc_nstacks() + 1 + 1;
 
     /* allocate driver region */
@@ -80,6 +82,8 @@ static int __init mpc_init_driver(void) {
     } else
         mpc_class->dev_uevent = mpc_dev_uevent;
 
+    mpc_stats_init();
+
     /* initialize devices */
     dev += mpc_stack_init(dev, mpc_class);
     dev += mpc_md5_init(dev, mpc_class);
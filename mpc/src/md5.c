@@ -24,132 +24,70 @@
 #include <linux/list.h>
 #include <linux/tty.h>
 #include <linux/sched/signal.h>
+#include <linux/mutex.h>
+#include <linux/uio.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#include <linux/io_uring.h>
+#endif
 
 #include "mpc.h"
+#include "../include/md5.h"
 
 #define MD5_DEV_NAME "md5"  // device name
-#define MD5_HASH_SIZE 16    // length on bytes
+#define MD5_URING_INLINE 4096   // bytes io_uring hashes inline before going to a worker
 
 // *****************************************************************************
 // *                            MD5 IMPL                                       *
 // *****************************************************************************
 
-// Per-round shift amounts
-static const uint32_t r[] = {7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
-                             5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
-                             4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
-                             6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
-
-// Use binary integer part of the sines of integers (in radians) as constants
-static const uint32_t k[] = {0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-                             0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-                             0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-                             0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-                             0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-                             0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-                             0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-                             0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-                             0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-                             0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-                             0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-                             0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-                             0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-                             0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-                             0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-                             0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
-
-// left rotate function definition
-#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
-
 /**
- * Original from https://gist.github.com/creationix/4710780
+ * Compute the digest of a user space buffer.
+ * The message is streamed through a small bounce buffer, so it is never
+ * copied whole into kernel memory.
  */
-ssize_t md5(uint32_t *h, const char __user *ubuff, size_t initial_len) {
-    // Message (to prepare)
-    uint8_t *msg = NULL;
-    uint32_t temp, bits_len;
-    int new_len, offset;
-
-    h[0] = 0x67452301;
-    h[1] = 0xefcdab89;
-    h[2] = 0x98badcfe;
-    h[3] = 0x10325476;
-
-    // Pre-processing: adding a single 1 bit
-    //append "1" bit to message
-    /* Notice: the input bytes are considered as bits strings,
-       where the first bit is the most significant bit of the byte.[37] */
-
-    // Pre-processing: padding with zeros
-    //append "0" bit until message length in bit ≡ 448 (mod 512)
-    //append length mod (2 pow 64) to message
-    new_len = ((((initial_len + 8) / 64) + 1) * 64) - 8;
-
-    /* allocate memory */
-    msg = kmalloc(new_len + 64, GFP_KERNEL); // also appends "0" bits (we alloc also 64 extra bytes...)
-    if (!msg)
-        return -ENOMEM;
-    memset(msg, 0, new_len + 64);
+ssize_t md5(uint8_t *digest, const char __user *ubuff, size_t initial_len) {
+    u64 start = ktime_get_ns();
+    struct mpc_md5_ctx ctx;
+    uint8_t bounce[256];
+    size_t n;
+
+    mpc_md5_reset(&ctx);
+
+    while (initial_len) {
+        n = min(initial_len, sizeof(bounce));
+        /* copy from user space to kernel space */
+        if (copy_from_user(bounce, ubuff, n))
+            return -EFAULT;
+        mpc_md5_update(&ctx, bounce, n);
+        ubuff += n;
+        initial_len -= n;
+        // messages can be any size, don't hog the CPU
+        cond_resched();
+    }
 
-    /* copy from user space to kernel space */
-    if (copy_from_user(msg, ubuff, initial_len))
-        return -EFAULT;
-    //memcpy(msg, initial_msg, initial_len);
-
-    msg[initial_len] = 128; // write the "1" bit
-
-    bits_len = 8*initial_len; // note, we append the len
-    memcpy(msg + new_len, &bits_len, 4); // in bits at the end of the buffer
-
-    // Process the message in successive 512-bit chunks:
-    //for each 512-bit chunk of message:
-    for(offset=0; offset<new_len; offset += (512/8)) {
-
-        // break chunk into sixteen 32-bit words w[j], 0 ≤ j ≤ 15
-        uint32_t *w = (uint32_t *) (msg + offset);
-
-        // Initialize hash value for this chunk:
-        uint32_t a = h[0];
-        uint32_t b = h[1];
-        uint32_t c = h[2];
-        uint32_t d = h[3];
-
-        // Main loop:
-        uint32_t i;
-        for(i = 0; i<64; i++) {
-            uint32_t f, g;
-
-             if (i < 16) {
-                f = (b & c) | ((~b) & d);
-                g = i;
-            } else if (i < 32) {
-                f = (d & b) | ((~d) & c);
-                g = (5*i + 1) % 16;
-            } else if (i < 48) {
-                f = b ^ c ^ d;
-                g = (3*i + 5) % 16;
-            } else {
-                f = c ^ (b | (~d));
-                g = (7*i) % 16;
-            }
-             
-            temp = d;
-            d = c;
-            c = b;
-            b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
-            a = temp;
-        }
+    mpc_md5_final(&ctx, digest);
+    mpc_stat_add(MPC_STAT_MD5_HASH, start);
+    return 0;
+}
 
-        // Add this chunk's hash to result so far:
-        h[0] += a;
-        h[1] += b;
-        h[2] += c;
-        h[3] += d;
+/**
+ * Hash the next 'len' bytes of an iov_iter, through a small bounce buffer.
+ */
+static int md5_iter(struct mpc_md5_ctx *ctx, struct iov_iter *from, size_t len) {
+    uint8_t bounce[256];
+    size_t n;
+
+    while (len) {
+        n = min(len, sizeof(bounce));
+        if (copy_from_iter(bounce, n, from) != n)
+            return -EFAULT;
+        mpc_md5_update(ctx, bounce, n);
+        len -= n;
+        cond_resched();
     }
 
-    // cleanup
-    kfree(msg);
-
     return 0;
 }
 
@@ -162,8 +100,11 @@ ssize_t md5(uint32_t *h, const char __user *ubuff, size_t initial_len) {
  */
 struct tty_listitem {
     dev_t key;                      ///< tty key
-    uint8_t hash[MD5_HASH_SIZE];    ///< Message-Digest buffer
+    uint8_t *hash;                  ///< Message-Digest buffer, one digest per segment on segment mode
+    size_t hash_len;                ///< Bytes on hash buffer
     size_t index;                   ///< Displacement on hash buffer (maybe the buffer is not read wholy)
+    bool segments;                  ///< Every writev() segment is a message
+    struct mutex lock;              ///< Protects the hash buffer
     struct list_head list;          ///< Pointer to the list head    
 };
 
@@ -177,18 +118,14 @@ static struct cdev  md5_cdev;
 static        dev_t md5_devno;
 
 /**
- * Look for a device or create one if missing.
+ * Allocate a device for a terminal. It can sleep, so it is called before
+ * taking 'tty_list_lock'.
  * @param key, Terminal key
- * @return The correspondent tty_listitem
+ * @return The new tty_listitem, NULL when out of memory
  */
-static struct tty_listitem *md5_lookfor_tty(dev_t key) {
+static struct tty_listitem *md5_alloc_tty(dev_t key) {
     struct tty_listitem *lptr;
 
-    list_for_each_entry(lptr, &tty_list, list) {
-        if (lptr->key == key)
-            return lptr;
-    }
-
     lptr = kmalloc(sizeof(struct tty_listitem), GFP_KERNEL);
     if (!lptr) /* no memory */
         return NULL;
@@ -197,12 +134,39 @@ static struct tty_listitem *md5_lookfor_tty(dev_t key) {
     memset(lptr, 0, sizeof(struct tty_listitem));
     lptr->key = key;
     lptr->index = 0;
+    mutex_init(&lptr->lock);
 
-    list_add(&lptr->list, &tty_list);
+    /* the digest reads as zeros until something is written */
+    lptr->hash = kzalloc(MD5_HASH_SIZE, GFP_KERNEL);
+    if (!lptr->hash) {
+        kfree(lptr);
+        return NULL;
+    }
+    lptr->hash_len = MD5_HASH_SIZE;
 
     return lptr;
 }
 
+/**
+ * Look for a device or insert 'new' if missing.
+ * The caller holds 'tty_list_lock'.
+ * @param key, Terminal key
+ * @param new, Device allocated with md5_alloc_tty() for 'key'
+ * @return The correspondent tty_listitem, 'new' when it was inserted
+ */
+static struct tty_listitem *md5_lookfor_tty(dev_t key, struct tty_listitem *new) {
+    struct tty_listitem *lptr;
+
+    list_for_each_entry(lptr, &tty_list, list) {
+        if (lptr->key == key)
+            return lptr;
+    }
+
+    list_add(&new->list, &tty_list);
+
+    return new;
+}
+
 // *****************************************************************************
 // *                            DEVICE OPERATIONS                              *
 // *****************************************************************************
@@ -212,7 +176,7 @@ static struct tty_listitem *md5_lookfor_tty(dev_t key) {
  * The device must be opened from a tty.
  */
 static int md5_open(struct inode *inode, struct file *filp) {
-    struct tty_listitem *tty_item;
+    struct tty_listitem *tty_item, *new;
     dev_t key;
 
     if (!current->signal->tty) {
@@ -221,13 +185,21 @@ static int md5_open(struct inode *inode, struct file *filp) {
     }
     key = tty_devnum(current->signal->tty);
 
+    /* allocate out of the spinlock, in case the tty is new */
+    new = md5_alloc_tty(key);
+    if (!new) /* no tty_item because kmalloc error */
+        return -ENOMEM;
+
     /* look for tty in the list */
     spin_lock(&tty_list_lock);
-    tty_item = md5_lookfor_tty(key);
+    tty_item = md5_lookfor_tty(key, new);
     spin_unlock(&tty_list_lock);
 
-    if (!tty_item) /* no tty_item because kmalloc error */
-        return -ENOMEM;
+    /* the tty already had its device */
+    if (tty_item != new) {
+        kfree(new->hash);
+        kfree(new);
+    }
 
     filp->private_data = tty_item;
 
@@ -235,14 +207,59 @@ static int md5_open(struct inode *inode, struct file *filp) {
 }
 
 /**
- * Read data from user buffer and compute message digest.
+ * Read data from user buffers and compute message digest. All the segments
+ * of a writev() are one message, with no gather copy on user space. On
+ * segment mode every non-empty segment is a message on its own instead.
  */
-static ssize_t md5_write(struct file *filp, const char __user *ubuff, size_t count, loff_t *f_pos) {
-    struct tty_listitem *tty_item = filp->private_data;
-    ssize_t err = md5((uint32_t*) tty_item->hash, ubuff, count);
-    /* don't reset buff index when err */
-    tty_item->index = err ? tty_item->index : 0;
-    return err ? err : count;
+static ssize_t md5_write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct tty_listitem *tty_item = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(from), max = 1, n = 0, len, i;
+    u64 start = ktime_get_ns();
+    struct mpc_md5_ctx ctx;
+    uint8_t *hash;
+    int err = 0;
+
+    if (tty_item->segments)
+        max = max_t(size_t, from->nr_segs, 1);
+
+    hash = kmalloc_array(max, MD5_HASH_SIZE, GFP_KERNEL);
+    if (!hash)
+        return -ENOMEM;
+
+    if (!tty_item->segments) {
+        mpc_md5_reset(&ctx);
+        err = md5_iter(&ctx, from, count);
+        mpc_md5_final(&ctx, hash);
+        n = 1;
+    } else {
+        for (i = 0; !err && i < max && iov_iter_count(from); i++) {
+            // step over empty segments
+            if (!(len = iov_iter_single_seg_count(from))) {
+                iov_iter_advance(from, 0);
+                continue;
+            }
+            mpc_md5_reset(&ctx);
+            err = md5_iter(&ctx, from, len);
+            mpc_md5_final(&ctx, hash + n++ * MD5_HASH_SIZE);
+        }
+    }
+
+    /* don't touch the last digest when err */
+    if (err) {
+        kfree(hash);
+        return err;
+    }
+
+    mpc_stat_add(MPC_STAT_MD5_HASH, start);
+
+    mutex_lock(&tty_item->lock);
+    kfree(tty_item->hash);
+    tty_item->hash = hash;
+    tty_item->hash_len = n * MD5_HASH_SIZE;
+    tty_item->index = 0;
+    mutex_unlock(&tty_item->lock);
+
+    return count;
 }
 
 /**
@@ -251,16 +268,85 @@ static ssize_t md5_write(struct file *filp, const char __user *ubuff, size_t cou
 static ssize_t md5_read(struct file *filp, char __user *ubuff, size_t count, loff_t *f_pos) {
     struct tty_listitem *tty_item = filp->private_data;
 
-    count = min(count, MD5_HASH_SIZE - tty_item->index);
+    if (mutex_lock_interruptible(&tty_item->lock))
+        return -ERESTARTSYS;
+
+    count = min(count, tty_item->hash_len - tty_item->index);
 
-    if (copy_to_user(ubuff, tty_item->hash + tty_item->index, count))
+    if (copy_to_user(ubuff, tty_item->hash + tty_item->index, count)) {
+        mutex_unlock(&tty_item->lock);
         return -EFAULT;
+    }
 
     tty_item->index += count;
 
+    mutex_unlock(&tty_item->lock);
     return count;
 }
 
+/**
+ * Control md5 device.
+ */
+static long md5_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct tty_listitem *tty_item = filp->private_data;
+
+    // check the command exist
+    if (_IOC_TYPE(cmd) != MD5_IOCTL_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > MD5_IOCTL_MAXNR)
+        return -ENOTTY;
+
+    switch (cmd) {
+        case MD5_SET_MODE:
+            if (arg > MD5_MODE_SEGMENTS)
+                return -EINVAL;
+            tty_item->segments = arg == MD5_MODE_SEGMENTS;
+            return 0;
+        default:
+            return -ENOTTY;
+    }
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+/**
+ * io_uring passthrough, MD5_URING_HASH hashes a batch of messages and
+ * completes with the number of digests written. A batch too big to hash
+ * inline fails with '-EAGAIN' and io_uring issues it again from a worker.
+ */
+static int md5_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    const struct md5_uring_cmd *cmd = ioucmd->cmd;
+    struct md5_batch __user *entries = u64_to_user_ptr(READ_ONCE(cmd->entries));
+    uint32_t nr = READ_ONCE(cmd->nr), i;
+    struct md5_batch entry;
+    size_t hashed = 0;
+    ssize_t err;
+
+    if (ioucmd->cmd_op != MD5_URING_HASH)
+        return -ENOTTY;
+    if (READ_ONCE(cmd->flags) || nr > MD5_BATCH_MAX)
+        return -EINVAL;
+
+    for (i = 0; i < nr; i++) {
+        if (copy_from_user(&entry, &entries[i], sizeof(entry)))
+            return -EFAULT;
+
+        // the worker starts over, digests are just written again
+        hashed += entry.len;
+        if ((issue_flags & IO_URING_F_NONBLOCK) && hashed > MD5_URING_INLINE)
+            return -EAGAIN;
+
+        if ((err = md5(entry.digest, u64_to_user_ptr(entry.buf), entry.len)))
+            return err;
+        if (copy_to_user(entries[i].digest, entry.digest, MD5_HASH_SIZE))
+            return -EFAULT;
+
+        cond_resched();
+    }
+
+    return nr;
+}
+#endif
+
 /**
  * MD5 file operations.
  */
@@ -269,7 +355,11 @@ static const struct file_operations md5_fops = {
         .llseek     = no_llseek,
         .open       = md5_open,
         .read       = md5_read,
-        .write      = md5_write,
+        .write_iter = md5_write_iter,
+        .unlocked_ioctl = md5_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+        .uring_cmd  = md5_uring_cmd,
+#endif
 };
 
 // *****************************************************************************
@@ -305,6 +395,7 @@ void mpc_md5_cleanup(struct class *cl) {
 
     list_for_each_entry_safe(lptr, next, &tty_list, list) {
         list_del(&lptr->list);
+        kfree(lptr->hash);
         kfree(lptr);
     }
 }
@@ -0,0 +1,162 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "mpc_core.h"
+
+// *****************************************************************************
+// *                            MD5 IMPL                                       *
+// *****************************************************************************
+
+// Per-round shift amounts
+static const uint32_t r[] = {7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,  7, 12, 17, 22,
+                             5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,  5,  9, 14, 20,
+                             4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,  4, 11, 16, 23,
+                             6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21,  6, 10, 15, 21};
+
+// Use binary integer part of the sines of integers (in radians) as constants
+static const uint32_t k[] = {0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+                             0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+                             0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+                             0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+                             0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+                             0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+                             0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+                             0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+                             0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+                             0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+                             0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+                             0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+                             0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+                             0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+                             0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+                             0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+// left rotate function definition
+#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
+
+/**
+ * Process one 512-bit chunk of the message.
+ * Original from https://gist.github.com/creationix/4710780
+ */
+static void md5_chunk(uint32_t *h, const uint8_t *chunk) {
+    uint32_t w[16], temp;
+    uint32_t a, b, c, d, i;
+
+    // break chunk into sixteen 32-bit little-endian words w[j], 0 ≤ j ≤ 15
+    for (i = 0; i < 16; i++)
+        w[i] = (uint32_t) chunk[4*i] | (uint32_t) chunk[4*i + 1] << 8 |
+               (uint32_t) chunk[4*i + 2] << 16 | (uint32_t) chunk[4*i + 3] << 24;
+
+    // Initialize hash value for this chunk:
+    a = h[0];
+    b = h[1];
+    c = h[2];
+    d = h[3];
+
+    // Main loop:
+    for(i = 0; i<64; i++) {
+        uint32_t f, g;
+
+        if (i < 16) {
+            f = (b & c) | ((~b) & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | ((~d) & c);
+            g = (5*i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3*i + 5) % 16;
+        } else {
+            f = c ^ (b | (~d));
+            g = (7*i) % 16;
+        }
+
+        temp = d;
+        d = c;
+        c = b;
+        b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
+        a = temp;
+    }
+
+    // Add this chunk's hash to result so far:
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+/**
+ * Start a new message digest.
+ */
+void mpc_md5_reset(struct mpc_md5_ctx *ctx) {
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xefcdab89;
+    ctx->h[2] = 0x98badcfe;
+    ctx->h[3] = 0x10325476;
+    ctx->len = 0;
+}
+
+/**
+ * Append 'len' bytes of kernel memory to the message. Whole chunks are
+ * hashed in place, only the trailing partial chunk is buffered.
+ */
+void mpc_md5_update(struct mpc_md5_ctx *ctx, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t used = ctx->len % 64, n;
+
+    ctx->len += len;
+
+    // complete the pending chunk first
+    if (used) {
+        n = min(len, 64 - used);
+        memcpy(ctx->block + used, p, n);
+        p += n;
+        len -= n;
+        if (used + n < 64)
+            return;
+        md5_chunk(ctx->h, ctx->block);
+    }
+
+    for (; len >= 64; p += 64, len -= 64)
+        md5_chunk(ctx->h, p);
+
+    memcpy(ctx->block, p, len);
+}
+
+/**
+ * Pad the message and write the 16 bytes digest.
+ */
+void mpc_md5_final(struct mpc_md5_ctx *ctx, uint8_t *digest) {
+    uint64_t bits_len = ctx->len * 8;
+    size_t used = ctx->len % 64;
+    int i;
+
+    // append "1" bit and "0" bits until message length in bit ≡ 448 (mod 512)
+    ctx->block[used++] = 128;
+    if (used > 56) {
+        memset(ctx->block + used, 0, 64 - used);
+        md5_chunk(ctx->h, ctx->block);
+        used = 0;
+    }
+    memset(ctx->block + used, 0, 56 - used);
+
+    // append length mod (2 pow 64) to message
+    for (i = 0; i < 8; i++)
+        ctx->block[56 + i] = bits_len >> (8 * i);
+    md5_chunk(ctx->h, ctx->block);
+
+    for (i = 0; i < MD5_HASH_SIZE; i++)
+        digest[i] = ctx->h[i / 4] >> (8 * (i % 4));
+}
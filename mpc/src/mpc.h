@@ -16,6 +16,8 @@
 #ifndef _MPC_H_
 #define _MPC_H_
 
+#include "mpc_core.h"
+
 #define MPC_DRIVER_NAME "mpc"       // driver name
 #define MPC_CLASS_NAME  "mpc_class"
 
@@ -30,7 +32,7 @@ extern struct class* mpc_class;
 
 /**
  * Initialize stack devices.
- * @return Amount of stack devices created
+ * @return Amount of minors used by stack devices
  */
 int mpc_stack_init(dev_t firstdev, struct class *cl);
 
@@ -40,7 +42,7 @@ int mpc_stack_init(dev_t firstdev, struct class *cl);
 void mpc_stack_cleanup(struct class *cl);
 
 /**
- * @return Number of stack devices created
+ * @return Number of minors needed by stack devices
  */
 int mpc_nstacks(void);
 
@@ -66,5 +68,32 @@ int mpc_rtc_init(dev_t firstdev, struct class *cl);
  */
 void mpc_rtc_cleanup(struct class *cl);
 
+/**
+ * Operations with a latency histogram.
+ */
+enum mpc_stat {
+    MPC_STAT_STACK_PUSH,
+    MPC_STAT_STACK_POP,
+    MPC_STAT_STACK_RESIZE,
+    MPC_STAT_MD5_HASH,
+    MPC_STAT_RTC_READ,
+    MPC_STAT_MAX
+};
+
+/**
+ * Count an operation of kind 'stat' started at 'start_ns' (ktime_get_ns())
+ * and done now. Lock-free.
+ */
+void mpc_stat_add(enum mpc_stat stat, u64 start_ns);
+
+/**
+ * Create the debugfs 'mpc/latency' file.
+ */
+void mpc_stats_init(void);
+
+/**
+ * Remove the debugfs files.
+ */
+void mpc_stats_cleanup(void);
 
 #endif //_MPC_H_
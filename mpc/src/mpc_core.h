@@ -0,0 +1,88 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef _MPC_CORE_H_
+#define _MPC_CORE_H_
+
+// Algorithms with no kernel dependencies, see mpc_compat.h
+
+#include "mpc_compat.h"
+
+#define MD5_HASH_SIZE   16          // md5 digest length on bytes
+
+#define STACK_MIN_LOAD  3           // stack load factor
+#define STACK_MIN_SIZE  512         // minimum stack size
+#define STACK_GROW_STEP (1UL << 28) // buffers over 256 MiB grow 256 MiB at a time
+#define STACK_MAX_SIZE  (7UL << 28) // biggest kvmalloc buffer, 1.75 GiB (under INT_MAX)
+
+/** BCD to binary. */
+#define BCD2BIN(x) (((x) & 0x0F) + ((x) >> 4) * 10)
+
+/**
+ * MD5 running state, so a message can be hashed piece by piece.
+ */
+struct mpc_md5_ctx {
+    uint32_t h[4];      ///< Intermediate hash value
+    uint64_t len;       ///< Message length on bytes
+    uint8_t block[64];  ///< Pending (incomplete) 512-bit chunk
+};
+
+/**
+ * Start a new message digest.
+ */
+void mpc_md5_reset(struct mpc_md5_ctx *ctx);
+
+/**
+ * Append 'len' bytes of kernel memory to the message.
+ */
+void mpc_md5_update(struct mpc_md5_ctx *ctx, const void *data, size_t len);
+
+/**
+ * Finish the message and write its MD5_HASH_SIZE bytes digest.
+ */
+void mpc_md5_final(struct mpc_md5_ctx *ctx, uint8_t *digest);
+
+/**
+ * Buffer size to hold 'size' bytes: the next power of two, or the next
+ * STACK_GROW_STEP over it. Never over STACK_MAX_SIZE nor 'limit' (0 = no
+ * limit) unless 'size' itself is.
+ */
+size_t mpc_stack_grow_size(size_t size, size_t limit);
+
+/**
+ * 'count' more bytes on a stack holding 'size' would go over 'limit'
+ * (0 = no limit).
+ */
+bool mpc_stack_over_limit(size_t size, size_t count, size_t limit);
+
+/**
+ * Buffer size after cutting a 'psize' bytes buffer in half, never under
+ * STACK_MIN_SIZE.
+ */
+size_t mpc_stack_shrink_size(size_t psize);
+
+/**
+ * A 'psize' bytes buffer holding 'lsize' bytes is loaded under
+ * 1/STACK_MIN_LOAD. Empty buffers never are, they keep their size.
+ */
+bool mpc_stack_underloaded(size_t psize, size_t lsize);
+
+/**
+ * Bytes to compress at the bottom of 'lsize' bytes so 'depth' to
+ * 'depth' + 'chunk' stay plain on top, a whole number of 'chunk's.
+ */
+size_t mpc_stack_cold_bytes(size_t lsize, size_t depth, size_t chunk);
+
+#endif //_MPC_CORE_H_
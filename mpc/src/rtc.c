@@ -25,6 +25,7 @@
 #include <linux/tty.h>
 #include <linux/sched/signal.h>
 #include <linux/ioctl.h>
+#include <linux/ktime.h>
 
 #include "mpc.h"
 #include "../include/rtc.h"
@@ -39,9 +40,6 @@
     inb_p(CMOS_REG_PORT); \
 })
 
-/** BCD to binary. */
-#define BCD2BIN(x) ((x & 0x0F) + (x >> 4) * 10)
-
 // CMOS layout
 // @see https://wiki.osdev.org/CMOS
 //
@@ -91,6 +89,7 @@ static int rtc_open(struct inode *inode, struct file *filp) {
  * Control RTC.
  */
 long rtc_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    u64 start = ktime_get_ns();
     unsigned char retval = 0;
 
     // check the command exist
@@ -120,6 +119,7 @@ long rtc_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
             return -ENOTTY;
     }
 
+    mpc_stat_add(MPC_STAT_RTC_READ, start);
     return BCD2BIN(retval);
 }
 
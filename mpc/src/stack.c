@@ -22,29 +22,106 @@
 #include <linux/semaphore.h>
 #include <linux/uaccess.h>
 #include <linux/log2.h>
+#include <linux/file.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/xarray.h>
+#include <linux/wait.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/crypto.h>
+#include <linux/ktime.h>
+#include <linux/shmem_fs.h>
+#include <linux/highmem.h>
+#include <linux/swap.h>
+#include <linux/topology.h>
+#include <linux/nodemask.h>
+#include <linux/device.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
+#include <linux/memcontrol.h>
+#include <linux/sched/mm.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+#include <linux/io_uring.h>
+#endif
 
 #include "mpc.h"
+#include "../include/stack.h"
 
-#define STACK_MIN_LOAD 3        // stack load factor
 #define STACK_N_DEVS   3        // by default stack0 through stack2
-#define STACK_MIN_SIZE 512      // minimum stack size
+#define STACK_MAX_DEVS 4096     // by default up to stack4095 through the control device
+#define STACK_MAX_MINORS (MINORMASK - 2) // the minor space but the control, md5 and rtc devices
+#define STACK_COLD_CHUNK 65536  // default size of compressed chunks
+#define STACK_MAX_VOTES 16      // most votes a node collects, pushes from another node needed to take its place
+#define STACK_COALESCE_DELAY 5  // default ms staged bytes wait to be pushed
+#define STACK_RESCHED_BYTES (1 << 20) // most bytes hashed or copied between two reschedule points
 #define STACK_DEV_NAME "stack"  // stack device name
+#define STACK_CTL_NAME "mpc-control" // control device name
+#define STACK_IDLE     xa_mk_value(0) // registry entry of a stack never opened
+
+#define STACK_NONBLOCK 0x1      // don't wait for room under the limit
+#define STACK_NOWAIT   0x2      // don't sleep at all, fail with EAGAIN instead
 
 // Forward definition
 struct stack;
+static const struct file_operations stack_fops;
+struct stack_file;
+static int stack_sync(struct stack_file *sf);
+static void stack_coalesce_work(struct work_struct *work);
+static int stack_copy(struct stack *dst, size_t dpos, struct stack *src, size_t spos, size_t count);
 
 // *****************************************************************************
 // *                                VARIABLES                                  *
 // *****************************************************************************
 
-static int      nstacks     = STACK_N_DEVS;	// number of stack devices
+static int      nstacks     = STACK_N_DEVS;	// number of stack devices created on load
+static int      maxstacks   = STACK_MAX_DEVS;   // number of minors reserved for stack devices
 static dev_t    stack_devno = -1;           // our first device number
+static dev_t    ctl_devno   = -1;           // control device number
+
+static struct class *stack_class;           // class where stack nodes are created
+static struct cdev   stack_cdev;            // one cdev for every stack minor
+static struct cdev   ctl_cdev;              // control device
+
+static DEFINE_XARRAY_ALLOC(stacks);         // stack devices (or STACK_IDLE) indexed by minor offset
+static DEFINE_MUTEX(stacks_lock);           // serializes stack creation and destruction
+
+static unsigned long stack_limit;           // default per-stack limit on bytes (0 = none)
+static unsigned long total_limit;           // limit on buffer bytes of all stacks (0 = none)
+static bool          limit_block;           // writers wait for room instead of failing
+static atomic_long_t total_bytes = ATOMIC_LONG_INIT(0); // buffer bytes of all stacks
 
-static struct stack *stacks;                // list of stack devices allocated on initialization
+static unsigned long cold_depth;            // bytes kept plain on top (0 = no compression)
+static unsigned long cold_chunk = STACK_COLD_CHUNK; // bytes compressed together
+static char         *cold_alg = "lz4";      // crypto API compression algorithm
+static bool          shmem_backing;         // new stacks keep their data on shmem
+static bool          huge_buffers = true;   // PMD mapped buffers of PMD_SIZE or more
+static unsigned int  coalesce_delay = STACK_COALESCE_DELAY; // ms staged writes wait for more
 
 /* register module parameter */
 module_param_named(stacks, nstacks, int, S_IRUGO);
 MODULE_PARM_DESC(stacks, "Number of stack devices");
+module_param_named(max_stacks, maxstacks, int, S_IRUGO);
+MODULE_PARM_DESC(max_stacks, "Maximum number of stack devices, including those created through " STACK_CTL_NAME);
+module_param(stack_limit, ulong, S_IRUGO);
+MODULE_PARM_DESC(stack_limit, "Default maximum bytes on a stack, 0 for no limit");
+module_param(total_limit, ulong, S_IRUGO);
+MODULE_PARM_DESC(total_limit, "Maximum buffer bytes used by all stacks together, 0 for no limit");
+module_param(limit_block, bool, S_IRUGO);
+MODULE_PARM_DESC(limit_block, "Block writers on a full stack instead of returning ENOSPC");
+module_param(cold_depth, ulong, S_IRUGO);
+MODULE_PARM_DESC(cold_depth, "Bytes kept uncompressed on top of every stack, 0 disables compression");
+module_param(cold_chunk, ulong, S_IRUGO);
+MODULE_PARM_DESC(cold_chunk, "Bytes of cold data compressed together");
+module_param(cold_alg, charp, S_IRUGO);
+MODULE_PARM_DESC(cold_alg, "Compression algorithm for cold data");
+module_param(shmem_backing, bool, S_IRUGO);
+MODULE_PARM_DESC(shmem_backing, "Keep stack data on swappable shmem instead of kernel memory");
+module_param(huge_buffers, bool, S_IRUGO);
+MODULE_PARM_DESC(huge_buffers, "Map stack buffers of 2 MiB or more with huge pages");
+module_param(coalesce_delay, uint, S_IRUGO);
+MODULE_PARM_DESC(coalesce_delay, "Milliseconds coalesced writes are staged before being pushed");
 
 // *****************************************************************************
 // *                    STACK STRUCT AND RELATED FUNCTIONS                     *
@@ -56,40 +133,402 @@ MODULE_PARM_DESC(stacks, "Number of stack devices");
 struct stack {
     int minor;              ///< Device minor
     char *buffer;           ///< Device data buffer
+    int node;               ///< NUMA node for 'buffer', NUMA_NO_NODE follows the writers
+    int hot_node;           ///< Node of the dominant writer
+    unsigned int votes;     ///< Confidence on 'hot_node'
+    bool shmem;             ///< Data lives on 'shm' instead of 'buffer'
+    struct file *shm;       ///< Internal shmem file, created on first use
     size_t psize;           ///< Buffer physical size
     size_t lsize;           ///< Buffer logical size
+    size_t limit;           ///< Maximum logical size (0 = no limit)
     struct semaphore sem;   ///< Mutual exclusion semaphore
-    struct cdev cdev;	    ///< cdev struct identifying this device
+    wait_queue_head_t wq;   ///< Writers waiting for room under 'limit', or for copies in flight
+    struct list_head pushes;            ///< Reserved pushes still copying from user space, bottom first
+    struct list_head pops;              ///< Reserved pops still copying to user space, top first
+    struct list_head peeks;             ///< Peeks still copying to user space
+    atomic_t drainers;      ///< Tasks waiting for the copies in flight to end
+    struct kref ref;        ///< One reference per open file plus the registry one
+    struct list_head cold;  ///< Compressed chunks under the buffer, bottom first
+    size_t csize;           ///< Logical size held by 'cold'
+    struct crypto_comp *tfm;            ///< Compressor, allocated on first use
+    struct stack_cold_stats cstats;     ///< Compression counters
+};
+
+/**
+ * A piece of cold data. It is kept raw when it doesn't compress.
+ */
+struct stack_chunk {
+    struct list_head list;  ///< Position on the cold list
+    size_t len;             ///< Uncompressed length
+    size_t clen;            ///< Stored length, equal to 'len' when raw
+    u8 data[];              ///< Stored data
+};
+
+/**
+ * A push or pop reserved under the semaphore whose user copy runs out of it.
+ */
+struct stack_resv {
+    struct list_head list;  ///< Position on 'pushes', 'pops' or 'peeks'
+    size_t pos;             ///< Storage offset of the reserved bytes
+    size_t len;             ///< Reserved bytes
+    bool failed;            ///< Copy failed, a kmalloc'ed copy left to be undone later
+};
+
+/**
+ * An open stack file. Small writes can be staged here and pushed together.
+ */
+struct stack_file {
+    struct stack *dev;          ///< Stack opened
+    struct mutex lock;          ///< Serializes the staging buffer
+    char *stage;                ///< Staged bytes, NULL when not coalescing
+    size_t size;                ///< Staging buffer size
+    size_t len;                 ///< Staged bytes
+    int err;                    ///< Error of a background push, reported once
+    struct mem_cgroup *memcg;   ///< Memory cgroup of the writer of the oldest staged byte
+    struct delayed_work work;   ///< Pushes the staged bytes after 'coalesce_delay'
 };
 
+/**
+ * A contiguous piece of the stack storage mapped on kernel space.
+ */
+struct stack_seg {
+    char *addr;             ///< Kernel address of the piece
+    size_t len;             ///< Bytes available at 'addr'
+    struct page *page;      ///< shmem page holding it, NULL for 'buffer'
+};
+
+/**
+ * Logical size of the stack, cold chunks included.
+ */
+static inline size_t stack_size(struct stack *dev) {
+    return dev->csize + dev->lsize;
+}
+
+/**
+ * 'count' more bytes would take the stack over its limit.
+ */
+static inline bool stack_over_limit(struct stack *dev, size_t count) {
+    return mpc_stack_over_limit(stack_size(dev), count, dev->limit);
+}
+
+/**
+ * No user copy is in flight, so the storage can be moved around.
+ */
+static inline bool stack_idle(struct stack *dev) {
+    return list_empty(&dev->pushes) && list_empty(&dev->pops) && list_empty(&dev->peeks);
+}
+
+/**
+ * A peek in flight reads bytes at or over 'pos'.
+ */
+static bool stack_peeked(struct stack *dev, size_t pos) {
+    struct stack_resv *resv;
+
+    list_for_each_entry(resv, &dev->peeks, list)
+        if (resv->pos + resv->len > pos)
+            return true;
+    return false;
+}
+
+/**
+ * Take the semaphore, or fail right away with STACK_NOWAIT.
+ */
+static inline int stack_lock(struct stack *dev, unsigned int flags) {
+    if (flags & STACK_NOWAIT)
+        return down_trylock(&dev->sem) ? -EAGAIN : 0;
+    return down_interruptible(&dev->sem) ? -ERESTARTSYS : 0;
+}
+
+/**
+ * Drop the semaphore until 'cond' holds. Evaluates to 0 with the semaphore
+ * taken again, or to an error without it: -ERESTARTSYS, or -EAGAIN when
+ * 'flags' has STACK_NOWAIT.
+ */
+#define stack_wait(dev, flags, cond) ({                                     \
+    int __err = 0;                                                          \
+    up(&(dev)->sem);                                                        \
+    if ((flags) & STACK_NOWAIT)                                             \
+        __err = -EAGAIN;                                                    \
+    else if (wait_event_interruptible((dev)->wq, cond) ||                   \
+             down_interruptible(&(dev)->sem))                               \
+        __err = -ERESTARTSYS;                                               \
+    __err;                                                                  \
+})
+
+/**
+ * Like stack_wait(), for a 'cond' that only the copies in flight can make
+ * true. New reservations hold off meanwhile, so it can't starve.
+ */
+#define stack_drain(dev, flags, cond) ({                                    \
+    int __err;                                                              \
+    atomic_inc(&(dev)->drainers);                                           \
+    __err = stack_wait(dev, flags, cond);                                   \
+    atomic_dec(&(dev)->drainers);                                           \
+    __err;                                                                  \
+})
+
+/**
+ * Wait, with the semaphore taken, until no user copy is in flight. On
+ * error the semaphore is not held anymore.
+ */
+static int stack_quiesce(struct stack *dev, unsigned int flags) {
+    if (stack_idle(dev))
+        return 0;
+    return stack_drain(dev, flags, stack_idle(dev));
+}
+
+/**
+ * The failed reservation 'resv' on 'list' can be undone now: the ones made
+ * after it are committed and, for a pop, no peek reads where its bytes go
+ * back.
+ */
+static inline bool stack_resv_ready(struct stack *dev, struct stack_resv *resv, struct list_head *list) {
+    return list_is_last(&resv->list, list) && (list == &dev->pushes || list_empty(&dev->peeks));
+}
+
+/**
+ * Wait until the failed reservation 'resv' on 'list' can be undone. Only
+ * used when stack_resv_defer() has no memory: the copies waited for take
+ * as long as their user space wants, and the undo can't be interrupted.
+ */
+static void stack_resv_wait(struct stack *dev, struct stack_resv *resv, struct list_head *list) {
+    atomic_inc(&dev->drainers);
+    while (!stack_resv_ready(dev, resv, list)) {
+        up(&dev->sem);
+        wait_event(dev->wq, stack_resv_ready(dev, resv, list));
+        down(&dev->sem);
+    }
+    atomic_dec(&dev->drainers);
+}
+
+/**
+ * Leave the undo of the failed reservation 'resv' to stack_resv_undo(), run
+ * by whoever commits the last reservation made after it, instead of
+ * waiting for it. 'resv' is replaced on its list by a kmalloc'ed copy.
+ * Return false when there is no memory for it.
+ */
+static bool stack_resv_defer(struct stack_resv *resv) {
+    struct stack_resv *hole = kmalloc(sizeof(*hole), GFP_KERNEL);
+
+    if (!hole)
+        return false;
+
+    hole->pos = resv->pos;
+    hole->len = resv->len;
+    hole->failed = true;
+    list_replace(&resv->list, &hole->list);
+    return true;
+}
+
+/**
+ * Undo the failed reservations left by stack_resv_defer() that are ready.
+ * The bytes over a failed push fill its hole, the bytes of a failed pop go
+ * back on top.
+ */
+static void stack_resv_undo(struct stack *dev) {
+    struct stack_resv *resv;
+
+    while (!list_empty(&dev->pushes)) {
+        resv = list_last_entry(&dev->pushes, struct stack_resv, list);
+        if (!resv->failed)
+            break;
+        stack_copy(dev, resv->pos, dev, resv->pos + resv->len, dev->lsize - resv->pos - resv->len);
+        dev->lsize -= resv->len;
+        list_del(&resv->list);
+        kfree(resv);
+    }
+
+    while (!list_empty(&dev->pops) && list_empty(&dev->peeks)) {
+        resv = list_last_entry(&dev->pops, struct stack_resv, list);
+        if (!resv->failed)
+            break;
+        stack_copy(dev, dev->lsize, dev, resv->pos, resv->len);
+        dev->lsize += resv->len;
+        list_del(&resv->list);
+        kfree(resv);
+    }
+}
+
+/**
+ * Allocate the state of stack 'index'.
+ */
+static struct stack *stack_alloc(unsigned long index) {
+    struct stack *dev = kzalloc(sizeof(struct stack), GFP_KERNEL);
+    if (!dev)
+        return NULL;
+
+    // init_MUTEX
+    sema_init(&dev->sem, 1);
+    init_waitqueue_head(&dev->wq);
+    INIT_LIST_HEAD(&dev->cold);
+    INIT_LIST_HEAD(&dev->pushes);
+    INIT_LIST_HEAD(&dev->pops);
+    INIT_LIST_HEAD(&dev->peeks);
+    kref_init(&dev->ref);
+    dev->minor = MINOR(stack_devno + index);
+    dev->limit = stack_limit;
+    dev->shmem = shmem_backing;
+    dev->node = NUMA_NO_NODE;
+    dev->hot_node = NUMA_NO_NODE;
+
+    return dev;
+}
+
+/**
+ * Free a stack once the registry and every open file dropped it.
+ */
+static void stack_free(struct kref *ref) {
+    struct stack *dev = container_of(ref, struct stack, ref);
+    struct stack_chunk *chunk, *next;
+
+    list_for_each_entry_safe(chunk, next, &dev->cold, list) {
+        atomic_long_sub(chunk->clen, &total_bytes);
+        kvfree(chunk);
+    }
+    if (dev->tfm)
+        crypto_free_comp(dev->tfm);
+
+    if (dev->buffer)
+        kvfree(dev->buffer);
+    if (dev->shm)
+        fput(dev->shm);
+    atomic_long_sub(dev->psize, &total_bytes);
+    kfree(dev);
+}
+
+/**
+ * Count a push from the current node. It's a majority vote over push calls
+ * (not bytes), so 'hot_node' ends up being the node that pushes most often.
+ * The buffer moves there on its next reallocation.
+ */
+static void stack_vote(struct stack *dev) {
+    int node = numa_node_id();
+
+    if (node == dev->hot_node) {
+        if (dev->votes < STACK_MAX_VOTES)
+            dev->votes++;
+    } else if (dev->votes == 0) {
+        dev->hot_node = node;
+        dev->votes = 1;
+    } else {
+        dev->votes--;
+    }
+}
+
+/**
+ * Node where the buffer should live.
+ */
+static int stack_node(struct stack *dev) {
+    return dev->node != NUMA_NO_NODE ? dev->node : dev->hot_node;
+}
+
+/**
+ * Resize a shmem backed stack. Pages are allocated when first touched,
+ * so growing costs nothing and shrinking drops the pages over 'size'.
+ */
+static int resize_shm(struct stack *dev, size_t size) {
+    struct file *shm;
+
+    if (!dev->shm) {
+        // as big as possible, the stack size is 'psize'
+        shm = shmem_kernel_file_setup(STACK_DEV_NAME, MAX_LFS_FILESIZE, VM_NORESERVE);
+        if (IS_ERR(shm))
+            return PTR_ERR(shm);
+        dev->shm = shm;
+    }
+
+    if (size < dev->psize)
+        shmem_truncate_range(file_inode(dev->shm), round_up(size, PAGE_SIZE), (loff_t) -1);
+
+    return 0;
+}
+
+/**
+ * Allocate a 'size' bytes buffer on 'node'. Buffers of PMD_SIZE or more
+ * are vmalloc'ed with PMD mappings when 'huge_buffers' is set, so a big
+ * stack needs one TLB entry per 2 MiB instead of 512. vmalloc_huge() takes
+ * no node, it allocates from the current one: a buffer that has to live
+ * elsewhere keeps its node and gets the kvmalloc_node() mappings instead,
+ * high order pages of the direct map or a vmalloc area of small pages.
+ */
+static void *stack_buffer_alloc(size_t size, int node) {
+    gfp_t gfp = GFP_KERNEL_ACCOUNT | __GFP_NOWARN;
+    void *buffer;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+    if (huge_buffers && size >= PMD_SIZE && (node == NUMA_NO_NODE || node == numa_node_id())) {
+        buffer = vmalloc_huge(size, gfp);
+        if (buffer)
+            return buffer;
+    }
+#endif
+
+    return kvmalloc_node(size, gfp, node);
+}
+
 /**
  * Reallocate memory for 'size' bytes and copy data to the new buffer.
- * If memory can't be allocated '-ENOMEN' is returned, 0 otherwise.
+ * The memory is charged to the caller's memory cgroup and comes from
+ * stack_buffer_alloc() on stack_node().
+ * If 'total_limit' would be exceeded, or a kernel memory buffer would be
+ * over STACK_MAX_SIZE, '-ENOSPC' is returned, if memory can't be
+ * allocated '-ENOMEN' is returned, 0 otherwise.
  */
 int realloc_buffer(struct stack *dev, size_t size) {
-    // allocate memory for new buffer
-    void *new_buffer = kzalloc(size, GFP_KERNEL);
-    if (!new_buffer)
-        return -ENOMEM;
+    long delta = (long) size - (long) dev->psize;
+    u64 start = ktime_get_ns();
+    void *new_buffer;
+    int err;
+
+    // kvmalloc() warns and fails over INT_MAX
+    if (!dev->shmem && size > STACK_MAX_SIZE)
+        return -ENOSPC;
+
+    // reserve the growth on the global counter first
+    if (delta > 0 && atomic_long_add_return(delta, &total_bytes) > total_limit && total_limit) {
+        atomic_long_sub(delta, &total_bytes);
+        return -ENOSPC;
+    }
+
+    if (dev->shmem) {
+        if ((err = resize_shm(dev, size))) {
+            if (delta > 0)
+                atomic_long_sub(delta, &total_bytes);
+            return err;
+        }
+    } else {
+        // allocate memory for new buffer
+        new_buffer = stack_buffer_alloc(size, stack_node(dev));
+        if (!new_buffer) {
+            if (delta > 0)
+                atomic_long_sub(delta, &total_bytes);
+            return -ENOMEM;
+        }
+
+        // copy data on new buffer
+        if (dev->buffer) {
+            memcpy(new_buffer, dev->buffer, dev->lsize);
+            kvfree(dev->buffer);
+        }
 
-    // copy data on new buffer
-    if (dev->buffer) {
-        memcpy(new_buffer, dev->buffer, dev->lsize);
-        kfree(dev->buffer);
+        dev->buffer = new_buffer;
     }
 
-    dev->buffer = new_buffer;
+    if (delta < 0)
+        atomic_long_add(delta, &total_bytes);
+
     dev->psize = size;
+    mpc_stat_add(MPC_STAT_STACK_RESIZE, start);
 
     return 0;
 }
 
 /**
- * Grow up the buffer to the next power of two.
+ * Grow up the buffer to the next power of two, without going over the
+ * stack limit.
  */
 int increase_buffer(struct stack *dev, size_t size) {
-    size_t new_size = roundup_pow_of_two(size);
-    return realloc_buffer(dev, new_size);
+    return realloc_buffer(dev, mpc_stack_grow_size(size, dev->limit));
 }
 
 /**
@@ -98,224 +537,1590 @@ int increase_buffer(struct stack *dev, size_t size) {
  * If memory can't be allocated '-ENOMEN' is returned, 0 otherwise.
  */
 int decrease_buffer(struct stack *dev) {
-    if (dev->psize == STACK_MIN_SIZE)
+    if (dev->psize <= STACK_MIN_SIZE)
+        return 0;
+
+    return realloc_buffer(dev, mpc_stack_shrink_size(dev->psize));
+}
+
+/**
+ * Grow up the buffer when 'size' bytes don't fit on it. The stack limit is
+ * checked by the callers adding bytes, thawing only moves them.
+ * Return '-ENOSPC' when over 'total_limit', '-ENOMEN' if memory can't be
+ * allocated, 0 otherwise.
+ */
+static int stack_grow(struct stack *dev, size_t size, const char *op) {
+    int err;
+
+    if (size <= dev->psize)
         return 0;
 
-    return realloc_buffer(dev, dev->psize / 2);
+    if ((err = increase_buffer(dev, size))) {
+        pr_err("mpc: stack%d: %s: unable to grow up the buffer\n", dev->minor, op);
+        return err;
+    }
+
+    pr_info("mpc: stack%d: %s: buffer resized to %zu bytes\n", dev->minor, op, dev->psize);
+    return 0;
+}
+
+/**
+ * Cut the buffer when its load falls under STACK_MIN_LOAD.
+ */
+static void stack_check_load(struct stack *dev, const char *op) {
+    if (!mpc_stack_underloaded(dev->psize, dev->lsize))
+        return;
+
+    if (decrease_buffer(dev)) {
+        pr_info("mpc: stack%d: %s: unable to reduce buffer size\n", dev->minor, op);
+    } else {
+        pr_info("mpc: stack%d: %s: buffer reduced to %zu bytes\n", dev->minor, op, dev->psize);
+    }
 }
 
 // *****************************************************************************
-// *                            FILE OPERATIONS                                *
+// *                            STORAGE ACCESS                                 *
 // *****************************************************************************
 
 /**
- * Open stack device.
+ * Map the storage at 'pos', up to 'len' bytes. A buffer gives them all at
+ * once, shmem gives one page at a time (reading it back from swap if
+ * needed), so only the pages near the top are ever touched.
  */
-static int stack_open(struct inode *inode, struct file *filp) {
-    struct stack *dev;
+static int stack_seg_get(struct stack *dev, size_t pos, size_t len, struct stack_seg *seg) {
+    struct page *page;
 
-    dev = container_of(inode->i_cdev, struct stack, cdev);
-    filp->private_data = dev;
+    if (!dev->shmem) {
+        seg->addr = dev->buffer + pos;
+        seg->len = len;
+        seg->page = NULL;
+        return 0;
+    }
 
-    if (down_interruptible(&dev->sem))
-        return -ERESTARTSYS;
+    page = shmem_read_mapping_page(dev->shm->f_mapping, pos >> PAGE_SHIFT);
+    if (IS_ERR(page))
+        return PTR_ERR(page);
 
-    if (!dev->buffer) { // allocate the buffer if needed
-        if (increase_buffer(dev, STACK_MIN_SIZE)) {
-            pr_info("mpc: stack%d: open: unable to allocate memory\n", dev->minor);
-            up(&dev->sem);
-            return -ENOMEM;
-        } else {
-            pr_info("mpc: stack%d: open: buffer initialized with %d bytes\n", dev->minor, STACK_MIN_SIZE);
-        }
-    }
+    seg->page = page;
+    seg->addr = (char *) kmap(page) + offset_in_page(pos);
+    seg->len = min_t(size_t, len, PAGE_SIZE - offset_in_page(pos));
+    return 0;
+}
 
-    pr_info("mpc: stack%d: open: process %i(%s) successfully opened the device\n", dev->minor, current->pid,
-            current->comm);
-    up(&dev->sem);
-    return nonseekable_open(inode, filp);
+/**
+ * Unmap a piece got with stack_seg_get().
+ */
+static void stack_seg_put(struct stack_seg *seg, bool dirty) {
+    if (!seg->page)
+        return;
+
+    kunmap(seg->page);
+    if (dirty)
+        set_page_dirty(seg->page);
+    mark_page_accessed(seg->page);
+    put_page(seg->page);
 }
 
 /**
- * Read 'count' bytes form top of stack
+ * Copy 'count' bytes of the storage at 'pos' to user space.
  */
-static ssize_t stack_read(struct file *filp, char __user *ubuff, size_t count, loff_t *f_pos) {
-    struct stack *dev = filp->private_data;
-    char *read;
-    int load;
+static int stack_to_user(struct stack *dev, char __user *ubuff, size_t pos, size_t count) {
+    struct stack_seg seg;
+    int err;
 
-    if (down_interruptible(&dev->sem))
-        return -ERESTARTSYS;
+    while (count) {
+        if ((err = stack_seg_get(dev, pos, count, &seg)))
+            return err;
+        err = copy_to_user(ubuff, seg.addr, seg.len) ? -EFAULT : 0;
+        stack_seg_put(&seg, false);
+        if (err)
+            return err;
 
-    // check if there is something to read
-    if (dev->lsize == 0) {
-        up(&dev->sem);
-        pr_info("mpc: stack%d: read: 0 bytes read\n", dev->minor);
-        return 0; // read nothing
+        ubuff += seg.len;
+        pos += seg.len;
+        count -= seg.len;
     }
 
-    // where start reading
-    count = min(count, dev->lsize);
-    read = dev->buffer + (dev->lsize - count);
+    return 0;
+}
 
-    if (copy_to_user(ubuff, read, count)) {
-        up (&dev->sem);
-        return -EFAULT;
-    }
-    dev->lsize -= count;
+/**
+ * Copy 'count' bytes from user space to the storage at 'pos'.
+ */
+static int stack_from_user(struct stack *dev, size_t pos, const char __user *ubuff, size_t count) {
+    struct stack_seg seg;
+    int err;
 
-    // check min load
-    if (dev->lsize != 0) {
-        load = dev->psize / dev->lsize;
-        if (load >= STACK_MIN_LOAD) {
-            if (decrease_buffer(dev)) {
-                pr_info("mpc: stack%d: read: unable to reduce buffer size\n", dev->minor);
-            } else {
-                pr_info("mpc: stack%d: read: buffer reduced to %zu bytes\n", dev->minor, dev->psize);
-            }
-        }
+    while (count) {
+        if ((err = stack_seg_get(dev, pos, count, &seg)))
+            return err;
+        err = copy_from_user(seg.addr, ubuff, seg.len) ? -EFAULT : 0;
+        stack_seg_put(&seg, true);
+        if (err)
+            return err;
+
+        ubuff += seg.len;
+        pos += seg.len;
+        count -= seg.len;
     }
 
-    up(&dev->sem);
-    pr_info("mpc: stack%d: read: %zu bytes read\n", dev->minor, count);
-    return count;
+    return 0;
 }
 
 /**
- * Push data on top of the stack.
+ * Copy 'count' bytes from kernel space to the storage at 'pos'.
  */
-static ssize_t stack_write(struct file *filp, const char __user *ubuff, size_t count, loff_t *f_pos) {
-    struct stack *dev = filp->private_data;
-    char *write;
-    size_t req_size; // required size
+static int stack_from_kernel(struct stack *dev, size_t pos, const char *kbuff, size_t count) {
+    struct stack_seg seg;
+    int err;
 
-    if (down_interruptible(&dev->sem))
-        return -ERESTARTSYS;
-
-    // if we don't have sufficient memory
-    req_size = dev->lsize + count;
-    if (req_size > dev->psize) {
-        if (increase_buffer(dev, req_size)) {
-            up(&dev->sem);
-            pr_err("mpc: stack%d: write: unable to grow up the buffer\n", dev->minor);
-            pr_info("mpc: stack%d: write: 0 bytes written\n", dev->minor);
-            return 0;
-        } else {
-            pr_info("mpc: stack%d: write: buffer resized to %zu bytes\n", dev->minor, dev->psize);
-        }
-    }
+    while (count) {
+        if ((err = stack_seg_get(dev, pos, count, &seg)))
+            return err;
+        memcpy(seg.addr, kbuff, seg.len);
+        stack_seg_put(&seg, true);
 
-    write = dev->buffer + dev->lsize;
-    if (copy_from_user(write, ubuff, count)) {
-        up(&dev->sem);
-        return -EFAULT;
+        kbuff += seg.len;
+        pos += seg.len;
+        count -= seg.len;
     }
-    dev->lsize += count;
 
-    up(&dev->sem);
-    pr_info("mpc: stack%d: write: %zu bytes written\n", dev->minor, count);
-    return count;
+    return 0;
 }
 
 /**
- * Release the device.
+ * Hash 'count' bytes of the storage at 'pos'. It can be the whole stack,
+ * so it reschedules every 'STACK_RESCHED_BYTES'.
  */
-static int stack_release(struct inode *inode, struct file *filp) {
-    struct stack *dev = filp->private_data;
-    pr_info("mpc: stack%d: release: process %i(%s) released the device\n", dev->minor, current->pid,
-            current->comm);
+static int stack_hash(struct stack *dev, struct mpc_md5_ctx *ctx, size_t pos, size_t count) {
+    struct stack_seg seg;
+    int err;
+
+    while (count) {
+        if ((err = stack_seg_get(dev, pos, min_t(size_t, count, STACK_RESCHED_BYTES), &seg)))
+            return err;
+        mpc_md5_update(ctx, seg.addr, seg.len);
+        stack_seg_put(&seg, false);
+
+        pos += seg.len;
+        count -= seg.len;
+        cond_resched();
+    }
+
     return 0;
 }
 
 /**
- * Stack file operations structure
+ * Copy 'count' bytes of 'src' storage at 'spos' to 'dst' storage at 'dpos'.
+ * Within one stack 'dpos' must be under 'spos'. A big transfer reschedules
+ * every 'STACK_RESCHED_BYTES'.
  */
-static const struct file_operations stack_fops = {
-    .owner      = THIS_MODULE,
-    .llseek     = no_llseek,
-    .open       = stack_open,
-    .read       = stack_read,
-    .write      = stack_write,
-    .release    = stack_release,
-};
+static int stack_copy(struct stack *dst, size_t dpos, struct stack *src, size_t spos, size_t count) {
+    struct stack_seg s, d;
+    int err;
+
+    while (count) {
+        if ((err = stack_seg_get(src, spos, min_t(size_t, count, STACK_RESCHED_BYTES), &s)))
+            return err;
+        if ((err = stack_seg_get(dst, dpos, s.len, &d))) {
+            stack_seg_put(&s, false);
+            return err;
+        }
+
+        // 'dst' may be 'src' a few bytes down
+        memmove(d.addr, s.addr, d.len);
+        stack_seg_put(&d, true);
+        stack_seg_put(&s, false);
+
+        spos += d.len;
+        dpos += d.len;
+        count -= d.len;
+        cond_resched();
+    }
+
+    return 0;
+}
 
 // *****************************************************************************
-// *                            INIT/CLEANUP IMPLEMENTATION                    *
+// *                            COLD STORAGE                                   *
 // *****************************************************************************
 
 /**
- * Initialize one stack
+ * Compress the buffer bytes deeper than 'cold_depth', one 'cold_chunk' at
+ * a time, and move what is left to the start of the buffer.
+ * shmem stacks are never compressed, their cold pages go to swap instead.
  */
-static void stack_init(struct stack *dev, struct class *cl, int index) {
-    int err, devno = stack_devno + index;
+static void stack_freeze(struct stack *dev) {
+    struct stack_chunk *chunk;
+    unsigned int clen;
+    size_t off = 0, cold;
+    u8 *scratch;
+    u64 start;
 
-    // init_MUTEX
-    sema_init(&dev->sem, 1);
+    cold = mpc_stack_cold_bytes(dev->lsize, cold_depth, cold_chunk);
+    if (!cold_depth || dev->shmem || !cold)
+        return;
 
-    dev->minor =    MINOR(devno);
-    dev->buffer =   NULL;
-    dev->psize =    0;
-    dev->lsize =    0;
+    if (!dev->tfm) {
+        dev->tfm = crypto_alloc_comp(cold_alg, 0, 0);
+        if (IS_ERR(dev->tfm)) {
+            pr_err("mpc: stack%d: freeze: unable to allocate '%s' compressor\n", dev->minor, cold_alg);
+            dev->tfm = NULL;
+            return;
+        }
+    }
 
-    /* setup cdev */
-    cdev_init(&dev->cdev, &stack_fops);
-    if ((err = cdev_add(&dev->cdev, devno, 1)))
-        pr_err("mpc: error %d adding stack%d\n", err, dev->minor);
+    scratch = kvmalloc(cold_chunk, GFP_KERNEL);
+    if (!scratch)
+        return;
 
-    if(device_create(cl, NULL, devno, NULL, STACK_DEV_NAME "%d", index) == NULL)
-        pr_err("mpc: device node creation failed\n");
-}
+    while (off < cold) {
+        start = ktime_get_ns();
+        clen = cold_chunk;
+        if (crypto_comp_compress(dev->tfm, (u8 *) dev->buffer + off, cold_chunk, scratch, &clen) || clen >= cold_chunk)
+            clen = cold_chunk; // keep it raw
+        dev->cstats.freeze_ns += ktime_get_ns() - start;
 
-/**
- * Initialize stack devices.
- * Return the amount of stack devices created.
- */
-int mpc_stack_init(dev_t firstdev, struct class *cl) {
-    int i;
+        chunk = kvmalloc(struct_size(chunk, data, clen), GFP_KERNEL_ACCOUNT);
+        if (!chunk)
+            break;
 
-    // check nstacks is greater than zero
-    if (nstacks < 1) {
-        pr_info("mpc: 0 stack devices created\n");
-        return 0;
+        chunk->len = cold_chunk;
+        chunk->clen = clen;
+        memcpy(chunk->data, clen < cold_chunk ? scratch : (u8 *) dev->buffer + off, clen);
+        list_add_tail(&chunk->list, &dev->cold);
+        atomic_long_add(clen, &total_bytes);
+
+        dev->csize += chunk->len;
+        dev->cstats.raw_bytes += chunk->len;
+        dev->cstats.packed_bytes += chunk->clen;
+        dev->cstats.chunks++;
+        dev->cstats.frozen += chunk->len;
+        off += chunk->len;
     }
 
-    stack_devno = firstdev;
+    kvfree(scratch);
 
-    // allocate memory for stack devices
-    stacks = kmalloc(nstacks * sizeof(struct stack), GFP_KERNEL);
-    if (stacks == NULL) {
-        pr_err("mpc: unable to allocate memory for stack devices\n");
+    if (off) {
+        memmove(dev->buffer, dev->buffer + off, dev->lsize - off);
+        dev->lsize -= off;
+        pr_info("mpc: stack%d: freeze: %zu bytes compressed\n", dev->minor, off);
+        stack_check_load(dev, "freeze");
+    }
+}
+
+/**
+ * Uncompress 'chunk' into 'dst'.
+ */
+static int stack_chunk_load(struct stack *dev, struct stack_chunk *chunk, void *dst) {
+    unsigned int len = chunk->len;
+    u64 start;
+    int err;
+
+    if (chunk->clen == chunk->len) {
+        memcpy(dst, chunk->data, len);
         return 0;
     }
 
-    // initialize stack devices
-    for (i = 0; i < nstacks; i++)
-        stack_init(&stacks[i], cl, i);
+    start = ktime_get_ns();
+    err = crypto_comp_decompress(dev->tfm, chunk->data, chunk->clen, dst, &len);
+    dev->cstats.thaw_ns += ktime_get_ns() - start;
 
-    return nstacks;
+    if (!err && len != chunk->len)
+        err = -EIO;
+    return err;
 }
 
 /**
- * Cleanup stack devices.
+ * Uncompress cold chunks back to the bottom of the buffer until its top
+ * 'need' bytes are plain, or nothing is cold anymore.
  */
-void mpc_stack_cleanup(struct class *cl) {
-    int i;
+static int stack_thaw(struct stack *dev, size_t need) {
+    struct stack_chunk *chunk;
+    int err;
+
+    while (dev->lsize < need && !list_empty(&dev->cold)) {
+        chunk = list_last_entry(&dev->cold, struct stack_chunk, list);
 
-    if (stacks) {
-        for (i = 0; i < nstacks; i++) {
-            device_destroy(cl, stack_devno + i);
-            cdev_del(&stacks[i].cdev);
+        if ((err = stack_grow(dev, dev->lsize + chunk->len, "thaw")))
+            return err;
 
-            if (stacks[i].buffer)
-                kfree(stacks[i].buffer);
+        memmove(dev->buffer + chunk->len, dev->buffer, dev->lsize);
+        if ((err = stack_chunk_load(dev, chunk, dev->buffer))) {
+            memmove(dev->buffer, dev->buffer + chunk->len, dev->lsize);
+            pr_err("mpc: stack%d: thaw: unable to uncompress chunk\n", dev->minor);
+            return err;
         }
 
-        kfree(stacks);
+        dev->lsize += chunk->len;
+        dev->csize -= chunk->len;
+        dev->cstats.raw_bytes -= chunk->len;
+        dev->cstats.packed_bytes -= chunk->clen;
+        dev->cstats.chunks--;
+        dev->cstats.thawed += chunk->len;
+
+        list_del(&chunk->list);
+        atomic_long_sub(chunk->clen, &total_bytes);
+        kvfree(chunk);
     }
 
-    stacks = NULL;
+    return 0;
 }
 
+/**
+ * Hash the cold chunks but their first 'skip' bytes, without thawing them.
+ */
+static int stack_cold_digest(struct stack *dev, struct mpc_md5_ctx *ctx, size_t skip) {
+    struct stack_chunk *chunk;
+    u8 *scratch = NULL;
+    int err = 0;
+
+    list_for_each_entry(chunk, &dev->cold, list) {
+        if (skip >= chunk->len) {
+            skip -= chunk->len;
+            continue;
+        }
+
+        if (chunk->clen == chunk->len) {
+            mpc_md5_update(ctx, chunk->data + skip, chunk->len - skip);
+        } else {
+            if (!scratch && !(scratch = kvmalloc(cold_chunk, GFP_KERNEL)))
+                return -ENOMEM;
+            if ((err = stack_chunk_load(dev, chunk, scratch)))
+                break;
+            mpc_md5_update(ctx, scratch + skip, chunk->len - skip);
+        }
+
+        skip = 0;
+        cond_resched();
+    }
+
+    kvfree(scratch);
+    return err;
+}
+
+// *****************************************************************************
+// *                            FILE OPERATIONS                                *
+// *****************************************************************************
+
+/**
+ * Take a reference on stack 'index'. An idle stack gets its state
+ * allocated here, so stacks never opened cost just a registry slot.
+ */
+static struct stack *stack_get(unsigned long index) {
+    struct stack *dev = NULL, *new = NULL;
+    void *entry;
+
+    for (;;) {
+        xa_lock(&stacks);
+        entry = xa_load(&stacks, index);
+
+        if (!entry) {
+            // destroyed (or never created)
+            dev = ERR_PTR(-ENODEV);
+        } else if (!xa_is_value(entry)) {
+            // the registry holds a reference while the stack is listed
+            dev = entry;
+            kref_get(&dev->ref);
+        } else if (new) {
+            // replacing an existing slot never allocates
+            __xa_store(&stacks, index, new, GFP_NOWAIT);
+            dev = new;
+            new = NULL;
+            kref_get(&dev->ref);
+        }
+
+        xa_unlock(&stacks);
+
+        if (dev)
+            break;
+
+        // first open, allocate out of the lock and try again
+        new = stack_alloc(index);
+        if (!new)
+            return ERR_PTR(-ENOMEM);
+    }
+
+    // somebody else won the race
+    if (new)
+        kfree(new);
+
+    return dev;
+}
+
+/**
+ * Open stack device.
+ */
+static int stack_open(struct inode *inode, struct file *filp) {
+    struct stack_file *sf;
+    struct stack *dev;
+
+    sf = kzalloc(sizeof(struct stack_file), GFP_KERNEL);
+    if (!sf)
+        return -ENOMEM;
+
+    dev = stack_get(MINOR(inode->i_rdev) - MINOR(stack_devno));
+    if (IS_ERR(dev)) {
+        kfree(sf);
+        return PTR_ERR(dev);
+    }
+
+    sf->dev = dev;
+    mutex_init(&sf->lock);
+    INIT_DELAYED_WORK(&sf->work, stack_coalesce_work);
+    filp->private_data = sf;
+
+    if (down_interruptible(&dev->sem)) {
+        kref_put(&dev->ref, stack_free);
+        kfree(sf);
+        return -ERESTARTSYS;
+    }
+
+    if (!dev->psize) { // allocate the buffer if needed
+        if (increase_buffer(dev, STACK_MIN_SIZE)) {
+            pr_info("mpc: stack%d: open: unable to allocate memory\n", dev->minor);
+            up(&dev->sem);
+            kref_put(&dev->ref, stack_free);
+            kfree(sf);
+            return -ENOMEM;
+        } else {
+            pr_info("mpc: stack%d: open: buffer initialized with %d bytes\n", dev->minor, STACK_MIN_SIZE);
+        }
+    }
+
+    pr_info("mpc: stack%d: open: process %i(%s) successfully opened the device\n", dev->minor, current->pid,
+            current->comm);
+    up(&dev->sem);
+
+    // read() pops (no position), pread() peeks 'pos' bytes below the top
+    stream_open(inode, filp);
+    filp->f_mode |= FMODE_PREAD;
+    return 0;
+}
+
+/**
+ * Copy 'count' bytes starting 'depth' bytes below the top of the stack,
+ * leaving the stack untouched.
+ */
+static ssize_t stack_peek(struct stack *dev, char __user *ubuff, size_t count, loff_t depth, unsigned int flags) {
+    struct stack_resv resv;
+    int err;
+
+    if (depth < 0)
+        return -EINVAL;
+
+    if ((err = stack_lock(dev, flags)))
+        return err;
+
+    // reserved bytes are not there yet, thawing moves the others
+    if ((err = stack_quiesce(dev, flags)))
+        return err;
+
+    // nothing below 'depth'
+    if (depth >= stack_size(dev)) {
+        up(&dev->sem);
+        return 0;
+    }
+
+    count = min(count, (size_t) (stack_size(dev) - depth));
+    if ((err = stack_thaw(dev, depth + count))) {
+        up(&dev->sem);
+        return err;
+    }
+
+    // copy out of the semaphore, the bytes stay put while on 'peeks'
+    resv.pos = dev->lsize - depth - count;
+    resv.len = count;
+    resv.failed = false;
+    list_add_tail(&resv.list, &dev->peeks);
+    up(&dev->sem);
+
+    err = stack_to_user(dev, ubuff, resv.pos, count);
+
+    down(&dev->sem);
+    list_del(&resv.list);
+    stack_resv_undo(dev);
+    wake_up(&dev->wq);
+    up(&dev->sem);
+
+    if (err)
+        return err;
+
+    pr_info("mpc: stack%d: peek: %zu bytes read at depth %lld\n", dev->minor, count, depth);
+    return count;
+}
+
+/**
+ * Reserve up to 'count' bytes on top of the stack, to be copied out of the
+ * semaphore and committed with stack_pop_end(). Return the bytes reserved,
+ * 0 when nothing was reserved (empty stack or 'count' 0).
+ */
+static ssize_t stack_pop_begin(struct stack *dev, size_t count, unsigned int flags, struct stack_resv *resv) {
+    int err = 0;
+
+    if ((err = stack_lock(dev, flags)))
+        return err;
+
+    for (;;) {
+        if (atomic_read(&dev->drainers) && !stack_idle(dev))
+            // somebody waits for the copies in flight, don't add more
+            err = stack_wait(dev, flags, stack_idle(dev));
+        else if (!list_empty(&dev->pushes))
+            // the top is still being written
+            err = stack_drain(dev, flags, list_empty(&dev->pushes));
+        else if (dev->lsize < min(count, stack_size(dev)) && !(list_empty(&dev->pops) && list_empty(&dev->peeks)))
+            // thawing moves the bytes other pops and peeks are reading
+            err = stack_drain(dev, flags, list_empty(&dev->pops) && list_empty(&dev->peeks));
+        else
+            break;
+        if (err)
+            return err;
+    }
+
+    // check if there is something to read, an empty reservation would never be committed
+    if (stack_size(dev) == 0 || count == 0) {
+        up(&dev->sem);
+        return 0; // read nothing
+    }
+
+    // where start reading
+    count = min(count, stack_size(dev));
+    if ((err = stack_thaw(dev, count))) {
+        up(&dev->sem);
+        return err;
+    }
+
+    resv->pos = dev->lsize - count;
+    resv->len = count;
+    resv->failed = false;
+    list_add_tail(&resv->list, &dev->pops);
+    dev->lsize -= count;
+
+    up(&dev->sem);
+    return count;
+}
+
+/**
+ * Commit a pop reserved with stack_pop_begin(). When the copy failed
+ * ('err' set) its bytes go back on top, later if pops under them or peeks
+ * are still copying.
+ * A commit can't be abandoned, so the semaphore is taken uninterruptibly,
+ * also for STACK_NOWAIT. It is never held over a user copy, the wait is
+ * short.
+ */
+static void stack_pop_end(struct stack *dev, struct stack_resv *resv, int err) {
+    down(&dev->sem);
+    if (!err) {
+        list_del(&resv->list);
+    } else if (stack_resv_ready(dev, resv, &dev->pops) || !stack_resv_defer(resv)) {
+        stack_resv_wait(dev, resv, &dev->pops);
+        stack_copy(dev, dev->lsize, dev, resv->pos, resv->len);
+        dev->lsize += resv->len;
+        list_del(&resv->list);
+    }
+    stack_resv_undo(dev);
+    wake_up(&dev->wq);
+
+    // check min load
+    if (stack_idle(dev))
+        stack_check_load(dev, "read");
+
+    up(&dev->sem);
+}
+
+/**
+ * Pop 'count' bytes form top of stack. The bytes are reserved under the
+ * semaphore, copied to user space out of it and committed again under it,
+ * so a slow copy doesn't hold other users of the stack.
+ */
+static ssize_t stack_pop(struct stack *dev, char __user *ubuff, size_t count, unsigned int flags) {
+    u64 start = ktime_get_ns();
+    struct stack_resv resv;
+    ssize_t ret;
+    int err;
+
+    if ((ret = stack_pop_begin(dev, count, flags, &resv)) <= 0) {
+        if (ret == 0)
+            pr_info("mpc: stack%d: read: 0 bytes read\n", dev->minor);
+        return ret;
+    }
+
+    err = stack_to_user(dev, ubuff, resv.pos, ret);
+    stack_pop_end(dev, &resv, err);
+    if (err)
+        return err;
+
+    mpc_stat_add(MPC_STAT_STACK_POP, start);
+    pr_info("mpc: stack%d: read: %zd bytes read\n", dev->minor, ret);
+    return ret;
+}
+
+/**
+ * Read data from the stack.
+ */
+static ssize_t stack_read(struct file *filp, char __user *ubuff, size_t count, loff_t *f_pos) {
+    struct stack_file *sf = filp->private_data;
+    int err;
+
+    // the file sees its own writes
+    if ((err = stack_sync(sf)))
+        return err;
+
+    // pread(): non-destructive read
+    if (f_pos)
+        return stack_peek(sf->dev, ubuff, count, *f_pos, 0);
+
+    return stack_pop(sf->dev, ubuff, count, 0);
+}
+
+/**
+ * Reserve 'count' bytes on top of the stack, growing the buffer if needed.
+ * The bytes are filled out of the semaphore and committed with
+ * stack_push_end(), so concurrent pushes overlap their copies.
+ */
+static int stack_push_begin(struct stack *dev, size_t count, unsigned int flags, struct stack_resv *resv) {
+    int err = 0;
+
+    if ((err = stack_lock(dev, flags)))
+        return err;
+
+    for (;;) {
+        if (atomic_read(&dev->drainers) && !stack_idle(dev)) {
+            // somebody waits for the copies in flight, don't add more
+            err = stack_wait(dev, flags, stack_idle(dev));
+        } else if (!list_empty(&dev->pops)) {
+            // pops in flight still read over the top
+            err = stack_wait(dev, flags, list_empty(&dev->pops));
+        } else if (stack_peeked(dev, dev->lsize)) {
+            // so do peeks of bytes popped since
+            err = stack_wait(dev, flags, list_empty(&dev->peeks));
+        } else if (limit_block && dev->limit && count <= dev->limit && stack_over_limit(dev, count)) {
+            // wait for readers to make room under the limit
+            if (flags & STACK_NONBLOCK) {
+                up(&dev->sem);
+                return -EAGAIN;
+            }
+            err = stack_wait(dev, flags, !stack_over_limit(dev, count));
+        } else if (dev->lsize + count > dev->psize && !(list_empty(&dev->pushes) && list_empty(&dev->peeks))) {
+            // growing moves the bytes other pushes are writing and peeks reading
+            err = stack_drain(dev, flags, list_empty(&dev->pushes) && list_empty(&dev->peeks));
+        } else {
+            break;
+        }
+        if (err)
+            return err;
+    }
+
+    // the limit holds even when the buffer has room, it may be lower than it
+    if (stack_over_limit(dev, count))
+        err = -ENOSPC;
+    else
+        err = stack_grow(dev, dev->lsize + count, "write");
+
+    // if we don't have sufficient memory
+    if (err) {
+        up(&dev->sem);
+        pr_info("mpc: stack%d: write: 0 bytes written\n", dev->minor);
+        return err;
+    }
+
+    resv->pos = dev->lsize;
+    resv->len = count;
+    resv->failed = false;
+    list_add_tail(&resv->list, &dev->pushes);
+    dev->lsize += count;
+
+    up(&dev->sem);
+    return 0;
+}
+
+/**
+ * Commit a push reserved with stack_push_begin(). When filling it failed
+ * ('err' set) its bytes are dropped, later if pushes over them are still
+ * copying. Like stack_pop_end(), it can't be interrupted.
+ */
+static void stack_push_end(struct stack *dev, struct stack_resv *resv, int err) {
+    down(&dev->sem);
+    if (!err) {
+        stack_vote(dev);
+        list_del(&resv->list);
+    } else if (stack_resv_ready(dev, resv, &dev->pushes) || !stack_resv_defer(resv)) {
+        stack_resv_wait(dev, resv, &dev->pushes);
+        stack_copy(dev, resv->pos, dev, resv->pos + resv->len, dev->lsize - resv->pos - resv->len);
+        dev->lsize -= resv->len;
+        list_del(&resv->list);
+    }
+    stack_resv_undo(dev);
+    wake_up(&dev->wq);
+
+    // compress what went deep enough
+    if (stack_idle(dev))
+        stack_freeze(dev);
+
+    up(&dev->sem);
+}
+
+/**
+ * Push 'count' bytes of user space on top of the stack.
+ */
+static ssize_t stack_push(struct stack *dev, const char __user *ubuff, size_t count, unsigned int flags) {
+    u64 start = ktime_get_ns();
+    struct stack_resv resv;
+    int err;
+
+    if ((err = stack_push_begin(dev, count, flags, &resv)))
+        return err;
+    err = stack_from_user(dev, resv.pos, ubuff, count);
+    stack_push_end(dev, &resv, err);
+    if (err)
+        return err;
+
+    mpc_stat_add(MPC_STAT_STACK_PUSH, start);
+    pr_info("mpc: stack%d: write: %zu bytes written\n", dev->minor, count);
+    return count;
+}
+
+/**
+ * Push the staged bytes of 'sf' as one block. They are kept when the push
+ * has to wait ('-EAGAIN', '-ERESTARTSYS'), any other error drops them and
+ * is kept on 'sf->err' to be reported later.
+ * The buffer growth is charged to the writer's memory cgroup, also when the
+ * push runs on a kworker.
+ * The caller holds 'sf->lock'.
+ */
+static int stack_publish(struct stack_file *sf, unsigned int flags) {
+    struct stack *dev = sf->dev;
+    u64 start = ktime_get_ns();
+    struct stack_resv resv;
+    struct mem_cgroup *old;
+    int err;
+
+    if (!sf->len)
+        return 0;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+    old = set_active_memcg(sf->memcg);
+#else
+    old = NULL;
+    memalloc_use_memcg(sf->memcg);
+#endif
+    if ((err = stack_push_begin(dev, sf->len, flags, &resv)) == 0) {
+        err = stack_from_kernel(dev, resv.pos, sf->stage, sf->len);
+        stack_push_end(dev, &resv, err);
+    }
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+    set_active_memcg(old);
+#else
+    memalloc_unuse_memcg();
+#endif
+
+    if (err == -EAGAIN || err == -ERESTARTSYS)
+        return err;
+
+    if (err) {
+        pr_info("mpc: stack%d: write: %zu staged bytes lost\n", dev->minor, sf->len);
+        sf->err = err;
+    } else {
+        mpc_stat_add(MPC_STAT_STACK_PUSH, start);
+        pr_info("mpc: stack%d: write: %zu bytes written\n", dev->minor, sf->len);
+    }
+    sf->len = 0;
+    mem_cgroup_put(sf->memcg);
+    sf->memcg = NULL;
+    return err;
+}
+
+/**
+ * Push what 'sf' has staged before the file reads the stack, so it sees
+ * its own writes. It doesn't wait for room under a limit, a file can't make
+ * it while reading.
+ */
+static int stack_sync(struct stack_file *sf) {
+    int err;
+
+    if (!sf->stage)
+        return 0;
+
+    if (mutex_lock_interruptible(&sf->lock))
+        return -ERESTARTSYS;
+    err = stack_publish(sf, STACK_NONBLOCK);
+    mutex_unlock(&sf->lock);
+
+    // errors are for the writer
+    return err == -ERESTARTSYS ? err : 0;
+}
+
+/**
+ * Push the staged bytes once 'coalesce_delay' is over. The work runs on the
+ * writer's CPU, so the push votes for the writer's node and a grown buffer
+ * is allocated there.
+ */
+static void stack_coalesce_work(struct work_struct *work) {
+    struct stack_file *sf = container_of(to_delayed_work(work), struct stack_file, work);
+
+    mutex_lock(&sf->lock);
+    // no room under the limit yet, try again later
+    if (stack_publish(sf, STACK_NONBLOCK) == -EAGAIN)
+        schedule_delayed_work_on(raw_smp_processor_id(), &sf->work, msecs_to_jiffies(coalesce_delay));
+    mutex_unlock(&sf->lock);
+}
+
+/**
+ * Stage a small write. Staged bytes are pushed together when the next write
+ * doesn't fit, after 'coalesce_delay' or when the file is read, synced or
+ * closed.
+ */
+static ssize_t stack_stage(struct stack_file *sf, const char __user *ubuff, size_t count, unsigned int flags) {
+    ssize_t ret = count;
+    int err;
+
+    if (mutex_lock_interruptible(&sf->lock))
+        return -ERESTARTSYS;
+
+    // report what the delayed push lost
+    if (sf->err) {
+        ret = sf->err;
+        sf->err = 0;
+        goto out;
+    }
+
+    // nothing to stage, don't arm the delayed push for it
+    if (!count)
+        goto out;
+
+    // keep the write order, older bytes go first
+    if (sf->len + count > sf->size && (err = stack_publish(sf, flags))) {
+        ret = err;
+        if (err != -EAGAIN && err != -ERESTARTSYS)
+            sf->err = 0;
+        goto out;
+    }
+
+    if (count >= sf->size) {
+        // too big to stage
+        ret = stack_push(sf->dev, ubuff, count, flags);
+    } else if (copy_from_user(sf->stage + sf->len, ubuff, count)) {
+        ret = -EFAULT;
+    } else {
+        // the delay counts from the oldest staged byte, its writer pays for the push
+        if (!sf->len) {
+            sf->memcg = get_mem_cgroup_from_mm(current->mm);
+            schedule_delayed_work_on(raw_smp_processor_id(), &sf->work, msecs_to_jiffies(coalesce_delay));
+        }
+        sf->len += count;
+    }
+
+    out:
+    mutex_unlock(&sf->lock);
+    return ret;
+}
+
+/**
+ * Push data on top of the stack.
+ */
+static ssize_t stack_write(struct file *filp, const char __user *ubuff, size_t count, loff_t *f_pos) {
+    struct stack_file *sf = filp->private_data;
+    unsigned int flags = filp->f_flags & O_NONBLOCK ? STACK_NONBLOCK : 0;
+
+    if (sf->stage)
+        return stack_stage(sf, ubuff, count, flags);
+
+    return stack_push(sf->dev, ubuff, count, flags);
+}
+
+/**
+ * Push the staged bytes and report any error lost on the way. With
+ * 'STACK_NONBLOCK' a stack full under its limit returns '-EAGAIN' and the
+ * bytes stay staged.
+ */
+static int stack_flush_stage(struct stack_file *sf, unsigned int flags) {
+    int err;
+
+    if (!sf->stage)
+        return 0;
+
+    mutex_lock(&sf->lock);
+    if ((err = stack_publish(sf, flags)) != -ERESTARTSYS && err != -EAGAIN) {
+        err = sf->err;
+        sf->err = 0;
+    }
+    mutex_unlock(&sf->lock);
+
+    return err;
+}
+
+/**
+ * Called on every close() of the file. close() doesn't wait for room under
+ * the limit: it returns '-EAGAIN' and the delayed push keeps trying while
+ * the file is open.
+ */
+static int stack_flush(struct file *filp, fl_owner_t id) {
+    return stack_flush_stage(filp->private_data, STACK_NONBLOCK);
+}
+
+/**
+ * fsync() pushes the staged bytes, waiting for room under the limit.
+ */
+static int stack_fsync(struct file *filp, loff_t start, loff_t end, int datasync) {
+    return stack_flush_stage(filp->private_data, 0);
+}
+
+/**
+ * Turn write coalescing on with a 'size' bytes staging buffer, or off when
+ * 'size' is 0. Anything staged is pushed first.
+ */
+static long stack_set_coalesce(struct stack_file *sf, unsigned long size) {
+    char *stage = NULL;
+    int err;
+
+    if (size > STACK_COALESCE_MAX)
+        return -EINVAL;
+
+    if (size && !(stage = kvmalloc(size, GFP_KERNEL_ACCOUNT)))
+        return -ENOMEM;
+
+    if (mutex_lock_interruptible(&sf->lock)) {
+        kvfree(stage);
+        return -ERESTARTSYS;
+    }
+
+    if ((err = stack_publish(sf, 0))) {
+        mutex_unlock(&sf->lock);
+        kvfree(stage);
+        return err;
+    }
+
+    cancel_delayed_work(&sf->work);
+    kvfree(sf->stage);
+    sf->stage = stage;
+    sf->size = size;
+
+    mutex_unlock(&sf->lock);
+    pr_info("mpc: stack%d: coalescing set to %lu bytes\n", sf->dev->minor, size);
+    return 0;
+}
+
+/**
+ * Hash the top of the stack in place, without popping it.
+ */
+static long stack_digest(struct stack *dev, struct stack_digest __user *uarg) {
+    struct stack_digest req;
+    struct mpc_md5_ctx ctx;
+    size_t skip;
+    int err;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    if ((err = stack_quiesce(dev, 0)))
+        return err;
+
+    // 0 means the whole stack
+    if (req.len == 0 || req.len > stack_size(dev))
+        req.len = stack_size(dev);
+
+    // bytes under the hashed ones
+    skip = stack_size(dev) - req.len;
+
+    mpc_md5_reset(&ctx);
+    if ((err = stack_cold_digest(dev, &ctx, skip))) {
+        up(&dev->sem);
+        return err;
+    }
+    skip = skip > dev->csize ? skip - dev->csize : 0;
+    if ((err = stack_hash(dev, &ctx, skip, dev->lsize - skip))) {
+        up(&dev->sem);
+        return err;
+    }
+    mpc_md5_final(&ctx, req.digest);
+
+    up(&dev->sem);
+    pr_info("mpc: stack%d: digest: %llu bytes hashed\n", dev->minor, req.len);
+
+    if (copy_to_user(uarg, &req, sizeof(req)))
+        return -EFAULT;
+
+    return 0;
+}
+
+/**
+ * Ioctl flavour of pread(), for callers that want the byte count back
+ * in the request.
+ */
+static long stack_peek_ioctl(struct stack *dev, struct stack_peek __user *uarg) {
+    struct stack_peek req;
+    ssize_t ret;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+    if (req.depth > LLONG_MAX)
+        return -EINVAL;
+
+    ret = stack_peek(dev, u64_to_user_ptr(req.buf), req.len, req.depth, 0);
+    if (ret < 0)
+        return ret;
+
+    req.len = ret;
+    if (copy_to_user(uarg, &req, sizeof(req)))
+        return -EFAULT;
+
+    return 0;
+}
+
+/**
+ * Move (or copy) the top 'len' bytes of 'src' on top of the stack opened
+ * as 'req.fd'. Both semaphores are always taken lower address first, so two
+ * opposite transfers can't deadlock.
+ */
+static long stack_xfer(struct stack *src, struct stack_xfer __user *uarg) {
+    struct stack_xfer req;
+    struct stack *dst, *first, *second;
+    struct fd f;
+    long err = 0;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+    if (req.flags & ~STACK_XFER_COPY)
+        return -EINVAL;
+
+    f = fdget(req.fd);
+    if (!f.file)
+        return -EBADF;
+
+    // destination must be another stack device
+    if (f.file->f_op != &stack_fops || ((struct stack_file *) f.file->private_data)->dev == src) {
+        fdput(f);
+        return -EINVAL;
+    }
+    dst = ((struct stack_file *) f.file->private_data)->dev;
+
+    first  = src < dst ? src : dst;
+    second = src < dst ? dst : src;
+
+    // no copy in flight on either stack, 'first' stays quiet while we hold it
+    if (down_interruptible(&first->sem)) {
+        fdput(f);
+        return -ERESTARTSYS;
+    }
+    if ((err = stack_quiesce(first, 0))) {
+        fdput(f);
+        return err;
+    }
+    if (down_interruptible(&second->sem)) {
+        up(&first->sem);
+        fdput(f);
+        return -ERESTARTSYS;
+    }
+    if ((err = stack_quiesce(second, 0))) {
+        up(&first->sem);
+        fdput(f);
+        return err;
+    }
+
+    // 0 means the whole stack
+    if (req.len == 0 || req.len > stack_size(src))
+        req.len = stack_size(src);
+
+    if (stack_over_limit(dst, req.len)) {
+        err = -ENOSPC;
+        goto out;
+    }
+    if ((err = stack_thaw(src, req.len)))
+        goto out;
+    if ((err = stack_grow(dst, dst->lsize + req.len, "xfer")))
+        goto out;
+
+    if ((err = stack_copy(dst, dst->lsize, src, src->lsize - req.len, req.len)))
+        goto out;
+    dst->lsize += req.len;
+    stack_vote(dst);
+    stack_freeze(dst);
+
+    if (!(req.flags & STACK_XFER_COPY)) {
+        src->lsize -= req.len;
+        wake_up(&src->wq);
+        stack_check_load(src, "xfer");
+    }
+
+    pr_info("mpc: stack%d: xfer: %llu bytes %s stack%d\n", src->minor, req.len,
+            req.flags & STACK_XFER_COPY ? "copied to" : "moved to", dst->minor);
+
+    out:
+    up(&second->sem);
+    up(&first->sem);
+    fdput(f);
+
+    if (!err && copy_to_user(uarg, &req, sizeof(req)))
+        err = -EFAULT;
+
+    return err;
+}
+
+/**
+ * Change the maximum logical size of the stack. Going over the module
+ * default 'stack_limit' needs CAP_SYS_RESOURCE.
+ */
+static long stack_set_limit(struct stack *dev, __u64 __user *uarg) {
+    __u64 limit;
+
+    if (copy_from_user(&limit, uarg, sizeof(limit)))
+        return -EFAULT;
+
+    if (stack_limit && (!limit || limit > stack_limit) && !capable(CAP_SYS_RESOURCE))
+        return -EPERM;
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+
+    // the stack can't shrink under its contents
+    if (limit && limit < stack_size(dev)) {
+        up(&dev->sem);
+        return -EBUSY;
+    }
+
+    dev->limit = limit;
+    wake_up(&dev->wq);
+
+    up(&dev->sem);
+    pr_info("mpc: stack%d: limit set to %llu bytes\n", dev->minor, limit);
+    return 0;
+}
+
+/**
+ * Switch an empty stack between kernel memory and shmem storage.
+ */
+static long stack_set_backing(struct stack *dev, unsigned long backing) {
+    int err;
+
+    if (backing > STACK_BACKING_SHMEM)
+        return -EINVAL;
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    if ((err = stack_quiesce(dev, 0)))
+        return err;
+
+    if (stack_size(dev)) {
+        up(&dev->sem);
+        return -EBUSY;
+    }
+
+    if (dev->shmem != (backing == STACK_BACKING_SHMEM)) {
+        // drop the old storage and set up the new one
+        if (dev->buffer)
+            kvfree(dev->buffer);
+        if (dev->shm)
+            fput(dev->shm);
+        atomic_long_sub(dev->psize, &total_bytes);
+
+        dev->buffer = NULL;
+        dev->shm = NULL;
+        dev->psize = 0;
+        dev->shmem = backing == STACK_BACKING_SHMEM;
+
+        if ((err = increase_buffer(dev, STACK_MIN_SIZE))) {
+            up(&dev->sem);
+            return err;
+        }
+    }
+
+    up(&dev->sem);
+    pr_info("mpc: stack%d: backing set to %s\n", dev->minor, dev->shmem ? "shmem" : "kmem");
+    return 0;
+}
+
+/**
+ * Report how much cold data is compressed and what it cost.
+ */
+static long stack_cold_stats(struct stack *dev, struct stack_cold_stats __user *uarg) {
+    struct stack_cold_stats stats;
+
+    if (down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    stats = dev->cstats;
+    up(&dev->sem);
+
+    if (copy_to_user(uarg, &stats, sizeof(stats)))
+        return -EFAULT;
+
+    return 0;
+}
+
+/**
+ * Control stack.
+ */
+static long stack_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    struct stack_file *sf = filp->private_data;
+    struct stack *dev = sf->dev;
+    int err;
+
+    // check the command exist
+    if (_IOC_TYPE(cmd) != STACK_IOCTL_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > STACK_IOCTL_MAXNR)
+        return -ENOTTY;
+
+    // the file sees its own writes
+    if (cmd != STACK_SET_COALESCE && (err = stack_sync(sf)))
+        return err;
+
+    switch (cmd) {
+        case STACK_DIGEST:
+            return stack_digest(dev, (struct stack_digest __user *) arg);
+        case STACK_PEEK:
+            return stack_peek_ioctl(dev, (struct stack_peek __user *) arg);
+        case STACK_XFER:
+            return stack_xfer(dev, (struct stack_xfer __user *) arg);
+        case STACK_SET_LIMIT:
+            return stack_set_limit(dev, (__u64 __user *) arg);
+        case STACK_COLD_STATS:
+            return stack_cold_stats(dev, (struct stack_cold_stats __user *) arg);
+        case STACK_SET_BACKING:
+            return stack_set_backing(dev, arg);
+        case STACK_SET_COALESCE:
+            return stack_set_coalesce(sf, arg);
+        default:
+            return -ENOTTY;
+    }
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+/**
+ * io_uring passthrough, a STACK_URING_* command. It runs inline when it
+ * doesn't have to sleep, otherwise it fails with '-EAGAIN' and io_uring
+ * issues it again from a worker. The result completes the request.
+ */
+static int stack_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags) {
+    struct stack_file *sf = ioucmd->file->private_data;
+    const struct stack_uring_cmd *cmd = ioucmd->cmd;
+    unsigned int flags = issue_flags & IO_URING_F_NONBLOCK ? STACK_NOWAIT : 0;
+    char __user *ubuff = u64_to_user_ptr(READ_ONCE(cmd->addr));
+    size_t len = READ_ONCE(cmd->len), staged;
+    int err;
+
+    // the result must fit
+    if (len > INT_MAX)
+        return -EINVAL;
+
+    // the file sees its own writes, staged bytes go first. Pushing them can
+    // wait, so inline only when nothing is staged.
+    if (sf->stage && (flags & STACK_NOWAIT)) {
+        if (!mutex_trylock(&sf->lock))
+            return -EAGAIN;
+        staged = sf->len;
+        mutex_unlock(&sf->lock);
+        if (staged)
+            return -EAGAIN;
+    } else if (sf->stage && (err = stack_sync(sf))) {
+        return err;
+    }
+
+    switch (ioucmd->cmd_op) {
+        case STACK_URING_PUSH:
+            if (ioucmd->file->f_flags & O_NONBLOCK)
+                flags |= STACK_NONBLOCK;
+            return stack_push(sf->dev, ubuff, len, flags);
+        case STACK_URING_POP:
+            return stack_pop(sf->dev, ubuff, len, flags);
+        case STACK_URING_PEEK:
+            return stack_peek(sf->dev, ubuff, len, READ_ONCE(cmd->depth), flags);
+        default:
+            return -ENOTTY;
+    }
+}
+#endif
+
+/**
+ * Release the device.
+ */
+static int stack_release(struct inode *inode, struct file *filp) {
+    struct stack_file *sf = filp->private_data;
+    struct stack *dev = sf->dev;
+
+    // .flush already pushed the staged bytes, unless it was interrupted or
+    // the stack was full. One last try, without waiting for room.
+    cancel_delayed_work_sync(&sf->work);
+    stack_flush_stage(sf, STACK_NONBLOCK);
+    if (sf->len)
+        pr_info("mpc: stack%d: release: %zu staged bytes lost\n", dev->minor, sf->len);
+    mem_cgroup_put(sf->memcg);
+    kvfree(sf->stage);
+    kfree(sf);
+
+    pr_info("mpc: stack%d: release: process %i(%s) released the device\n", dev->minor, current->pid,
+            current->comm);
+    kref_put(&dev->ref, stack_free);
+    return 0;
+}
+
+/**
+ * Stack file operations structure
+ */
+static const struct file_operations stack_fops = {
+    .owner          = THIS_MODULE,
+    .llseek         = no_llseek,
+    .open           = stack_open,
+    .read           = stack_read,
+    .write          = stack_write,
+    .unlocked_ioctl = stack_ioctl,
+    .flush          = stack_flush,
+    .fsync          = stack_fsync,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+    .uring_cmd      = stack_uring_cmd,
+#endif
+    .release        = stack_release,
+};
+
+// *****************************************************************************
+// *                            SYSFS ATTRIBUTES                               *
+// *****************************************************************************
+
+/**
+ * NUMA node of the stack buffer, -1 when it follows the writers.
+ */
+static ssize_t numa_node_show(struct device *d, struct device_attribute *attr, char *buf) {
+    unsigned long index = (unsigned long) dev_get_drvdata(d);
+    struct stack *dev;
+    int node;
+
+    // don't allocate idle stacks just to say they have no node
+    xa_lock(&stacks);
+    dev = xa_load(&stacks, index);
+    node = dev && !xa_is_value(dev) ? dev->node : NUMA_NO_NODE;
+    xa_unlock(&stacks);
+
+    return sprintf(buf, "%d\n", node);
+}
+
+/**
+ * Pin the stack buffer to a node, its data is moved right away.
+ */
+static ssize_t numa_node_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) {
+    struct stack *dev;
+    int node, err = 0;
+
+    if (kstrtoint(buf, 10, &node))
+        return -EINVAL;
+    if (node != NUMA_NO_NODE && (node < 0 || node >= nr_node_ids || !node_online(node)))
+        return -EINVAL;
+
+    dev = stack_get((unsigned long) dev_get_drvdata(d));
+    if (IS_ERR(dev))
+        return PTR_ERR(dev);
+
+    if (down_interruptible(&dev->sem)) {
+        kref_put(&dev->ref, stack_free);
+        return -ERESTARTSYS;
+    }
+    if ((err = stack_quiesce(dev, 0))) {
+        kref_put(&dev->ref, stack_free);
+        return err;
+    }
+
+    dev->node = node;
+    if (dev->buffer)
+        err = realloc_buffer(dev, dev->psize);
+
+    up(&dev->sem);
+    pr_info("mpc: stack%d: numa node set to %d\n", dev->minor, node);
+    kref_put(&dev->ref, stack_free);
+
+    return err ? err : count;
+}
+
+static DEVICE_ATTR_RW(numa_node);
+
+static struct attribute *stack_attrs[] = {
+    &dev_attr_numa_node.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(stack);
+
+// *****************************************************************************
+// *                            STACK REGISTRY                                 *
+// *****************************************************************************
+
+/**
+ * Create the stack device 'index', or the first free one if 'index' is
+ * negative. Its state is allocated on first open.
+ * Return the index of the new stack or a negative error.
+ */
+static int stack_create(int index) {
+    struct device *node;
+    u32 id = index;
+    int err;
+
+    mutex_lock(&stacks_lock);
+
+    if (index < 0)
+        err = xa_alloc(&stacks, &id, STACK_IDLE, XA_LIMIT(0, maxstacks - 1), GFP_KERNEL);
+    else
+        err = xa_insert(&stacks, id, STACK_IDLE, GFP_KERNEL);
+    if (err) {
+        mutex_unlock(&stacks_lock);
+        return err == -EBUSY && index < 0 ? -ENOSPC : err;
+    }
+
+    node = device_create_with_groups(stack_class, NULL, stack_devno + id, (void *) (unsigned long) id,
+                                     stack_groups, STACK_DEV_NAME "%d", id);
+    if (IS_ERR(node)) {
+        pr_err("mpc: device node creation failed\n");
+        xa_erase(&stacks, id);
+        mutex_unlock(&stacks_lock);
+        return PTR_ERR(node);
+    }
+
+    mutex_unlock(&stacks_lock);
+    return id;
+}
+
+/**
+ * Destroy the stack device 'index'. Files still opened on it keep working
+ * on its data until they are released.
+ */
+static int stack_destroy(unsigned long index) {
+    void *entry;
+
+    mutex_lock(&stacks_lock);
+
+    entry = xa_erase(&stacks, index);
+    if (!entry) {
+        mutex_unlock(&stacks_lock);
+        return -ENODEV;
+    }
+
+    device_destroy(stack_class, stack_devno + index);
+
+    mutex_unlock(&stacks_lock);
+    pr_info("mpc: stack%lu: destroyed\n", index);
+
+    if (!xa_is_value(entry))
+        kref_put(&((struct stack *) entry)->ref, stack_free);
+    return 0;
+}
+
+// *****************************************************************************
+// *                            CONTROL DEVICE                                 *
+// *****************************************************************************
+
+/**
+ * Open control device.
+ */
+static int ctl_open(struct inode *inode, struct file *filp) {
+    return nonseekable_open(inode, filp);
+}
+
+/**
+ * Create and destroy stacks.
+ */
+static long ctl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    // check the command exist
+    if (_IOC_TYPE(cmd) != STACK_CTL_MAGIC)
+        return -ENOTTY;
+    if (_IOC_NR(cmd) > STACK_CTL_MAXNR)
+        return -ENOTTY;
+
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    switch (cmd) {
+        case STACK_CTL_CREATE:
+            return stack_create(-1);
+        case STACK_CTL_DESTROY:
+            return stack_destroy(arg);
+        default:
+            return -ENOTTY;
+    }
+}
+
+/**
+ * Control file operations.
+ */
+static const struct file_operations ctl_fops = {
+    .owner          = THIS_MODULE,
+    .llseek         = no_llseek,
+    .open           = ctl_open,
+    .unlocked_ioctl = ctl_ioctl,
+};
+
+// *****************************************************************************
+// *                            INIT/CLEANUP IMPLEMENTATION                    *
+// *****************************************************************************
+
+/**
+ * Initialize stack devices.
+ * Return the amount of minors used: every stack plus the control device.
+ */
+int mpc_stack_init(dev_t firstdev, struct class *cl) {
+    int i, err;
+
+    stack_devno = firstdev;
+    ctl_devno = firstdev + maxstacks;
+    stack_class = cl;
+
+    // chunks are uncompressed on a single buffer
+    cold_chunk = clamp_t(unsigned long, cold_chunk, PAGE_SIZE, KMALLOC_MAX_SIZE);
+
+    /* setup a single cdev for every stack, present and future */
+    cdev_init(&stack_cdev, &stack_fops);
+    if ((err = cdev_add(&stack_cdev, stack_devno, maxstacks))) {
+        pr_err("mpc: error %d adding stack devices\n", err);
+        stack_devno = -1;
+        return maxstacks + 1;
+    }
+
+    /* setup control cdev */
+    cdev_init(&ctl_cdev, &ctl_fops);
+    if ((err = cdev_add(&ctl_cdev, ctl_devno, 1))) {
+        pr_err("mpc: error %d adding " STACK_CTL_NAME "\n", err);
+        ctl_devno = -1;
+    } else if (IS_ERR(device_create(cl, NULL, ctl_devno, NULL, STACK_CTL_NAME))) {
+        pr_err("mpc: " STACK_CTL_NAME " device node creation failed\n");
+        cdev_del(&ctl_cdev);
+        ctl_devno = -1;
+    }
+
+    // initialize stack devices
+    for (i = 0; i < nstacks; i++) {
+        if ((err = stack_create(i)) < 0) {
+            pr_err("mpc: error %d creating stack%d\n", err, i);
+            break;
+        }
+    }
+
+    pr_info("mpc: %d stack devices created\n", i);
+    return maxstacks + 1;
+}
+
+/**
+ * Cleanup stack devices.
+ */
+void mpc_stack_cleanup(struct class *cl) {
+    void *entry;
+    unsigned long index;
+
+    xa_for_each(&stacks, index, entry)
+        stack_destroy(index);
+
+    if (stack_devno != -1)
+        cdev_del(&stack_cdev);
+    stack_devno = -1;
+
+    if (ctl_devno != -1) {
+        device_destroy(cl, ctl_devno);
+        cdev_del(&ctl_cdev);
+    }
+    ctl_devno = -1;
+}
+
+/**
+ * Minors needed by stack devices.
+ */
 int mpc_nstacks(void) {
-    return nstacks;
+    // at least the stacks created on load must fit
+    nstacks = clamp(nstacks, 0, STACK_MAX_MINORS);
+    maxstacks = clamp(maxstacks, nstacks, STACK_MAX_MINORS);
+    return maxstacks + 1;
 }
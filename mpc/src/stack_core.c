@@ -0,0 +1,57 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "mpc_core.h"
+
+// *****************************************************************************
+// *                            BUFFER SIZE POLICY                             *
+// *****************************************************************************
+
+size_t mpc_stack_grow_size(size_t size, size_t limit) {
+    size_t new_size;
+
+    // doubling a big buffer would ask for more than kvmalloc can give
+    if (size <= STACK_GROW_STEP)
+        new_size = roundup_pow_of_two(size);
+    else
+        new_size = (size + STACK_GROW_STEP - 1) / STACK_GROW_STEP * STACK_GROW_STEP;
+
+    if (new_size > STACK_MAX_SIZE)
+        new_size = max_t(size_t, size, STACK_MAX_SIZE);
+
+    if (limit && new_size > limit)
+        new_size = max(size, limit);
+
+    return new_size;
+}
+
+bool mpc_stack_over_limit(size_t size, size_t count, size_t limit) {
+    return limit && (count > limit || size > limit - count);
+}
+
+size_t mpc_stack_shrink_size(size_t psize) {
+    return max_t(size_t, psize / 2, STACK_MIN_SIZE);
+}
+
+bool mpc_stack_underloaded(size_t psize, size_t lsize) {
+    return lsize != 0 && psize / lsize >= STACK_MIN_LOAD;
+}
+
+size_t mpc_stack_cold_bytes(size_t lsize, size_t depth, size_t chunk) {
+    if (!chunk || lsize < depth + chunk)
+        return 0;
+
+    return (lsize - depth) / chunk * chunk;
+}
@@ -0,0 +1,185 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/fs.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+
+#include "mpc.h"
+
+#define MPC_STAT_BUCKETS 40     // log2 buckets, the last one takes anything over 2^38 ns (~4.6 min)
+
+// *****************************************************************************
+// *                            VARIABLES                                      *
+// *****************************************************************************
+
+/**
+ * Latencies of one operation on one CPU.
+ */
+struct mpc_hist {
+    u64 buckets[MPC_STAT_BUCKETS];  ///< Bucket 0 counts 0 ns, bucket b counts [2^(b-1), 2^b) ns
+    u64 sum_ns;                     ///< Sum of every latency, for the mean
+};
+
+// only the owner CPU writes its histograms, readers add every CPU up
+static DEFINE_PER_CPU(struct mpc_hist [MPC_STAT_MAX], mpc_hists);
+
+static const char * const mpc_stat_names[MPC_STAT_MAX] = {
+    [MPC_STAT_STACK_PUSH]   = "stack_push",
+    [MPC_STAT_STACK_POP]    = "stack_pop",
+    [MPC_STAT_STACK_RESIZE] = "stack_resize",
+    [MPC_STAT_MD5_HASH]     = "md5_hash",
+    [MPC_STAT_RTC_READ]     = "rtc_read",
+};
+
+static struct dentry *mpc_debugfs;
+
+// *****************************************************************************
+// *                            RECORD                                         *
+// *****************************************************************************
+
+void mpc_stat_add(enum mpc_stat stat, u64 start_ns) {
+    u64 ns = ktime_get_ns() - start_ns;
+    unsigned int b = ns ? min_t(unsigned int, ilog2(ns) + 1, MPC_STAT_BUCKETS - 1) : 0;
+
+    // per-CPU counters, safe against preemption without locks
+    this_cpu_inc(mpc_hists[stat].buckets[b]);
+    this_cpu_add(mpc_hists[stat].sum_ns, ns);
+}
+
+/**
+ * Add up the histograms of 'stat' from every CPU.
+ */
+static void mpc_stat_sum(enum mpc_stat stat, struct mpc_hist *hist) {
+    struct mpc_hist *h;
+    int cpu, b;
+
+    memset(hist, 0, sizeof(*hist));
+    for_each_possible_cpu(cpu) {
+        h = per_cpu_ptr(&mpc_hists[stat], cpu);
+        for (b = 0; b < MPC_STAT_BUCKETS; b++)
+            hist->buckets[b] += READ_ONCE(h->buckets[b]);
+        hist->sum_ns += READ_ONCE(h->sum_ns);
+    }
+}
+
+/**
+ * Upper bound in ns of the bucket holding the 'permille' percentile of
+ * 'count' samples.
+ */
+static u64 mpc_stat_percentile(const struct mpc_hist *hist, u64 count, unsigned int permille) {
+    u64 rank = div_u64(count * permille + 999, 1000), seen = 0;
+    int b;
+
+    for (b = 0; b < MPC_STAT_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen >= rank)
+            break;
+    }
+
+    return b ? 1ULL << min(b, MPC_STAT_BUCKETS - 1) : 0;
+}
+
+// *****************************************************************************
+// *                            DEBUGFS                                        *
+// *****************************************************************************
+
+/**
+ * One line per operation with its percentiles, then the non-empty buckets
+ * of every operation.
+ */
+static int mpc_stats_show(struct seq_file *m, void *v) {
+    struct mpc_hist hist;
+    u64 count;
+    int stat, b;
+
+    seq_printf(m, "%-13s %12s %10s %10s %10s %10s %10s\n",
+               "op", "count", "mean_ns", "p50_ns", "p90_ns", "p99_ns", "p999_ns");
+
+    for (stat = 0; stat < MPC_STAT_MAX; stat++) {
+        mpc_stat_sum(stat, &hist);
+        for (count = 0, b = 0; b < MPC_STAT_BUCKETS; b++)
+            count += hist.buckets[b];
+
+        seq_printf(m, "%-13s %12llu %10llu %10llu %10llu %10llu %10llu\n", mpc_stat_names[stat], count,
+                   count ? div64_u64(hist.sum_ns, count) : 0,
+                   mpc_stat_percentile(&hist, count, 500),
+                   mpc_stat_percentile(&hist, count, 900),
+                   mpc_stat_percentile(&hist, count, 990),
+                   mpc_stat_percentile(&hist, count, 999));
+    }
+
+    for (stat = 0; stat < MPC_STAT_MAX; stat++) {
+        mpc_stat_sum(stat, &hist);
+        seq_printf(m, "\n%s:\n", mpc_stat_names[stat]);
+        for (b = 0; b < MPC_STAT_BUCKETS; b++) {
+            if (!hist.buckets[b])
+                continue;
+            if (b == MPC_STAT_BUCKETS - 1)
+                seq_printf(m, "  >= %llu ns: %llu\n", 1ULL << (b - 1), hist.buckets[b]);
+            else
+                seq_printf(m, "  < %llu ns: %llu\n", b ? 1ULL << b : 1, hist.buckets[b]);
+        }
+    }
+
+    return 0;
+}
+
+static int mpc_stats_open(struct inode *inode, struct file *filp) {
+    return single_open(filp, mpc_stats_show, NULL);
+}
+
+/**
+ * Any write clears every histogram. Operations running meanwhile may
+ * still land on the old counts.
+ */
+static ssize_t mpc_stats_write(struct file *filp, const char __user *ubuff, size_t count, loff_t *f_pos) {
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(&mpc_hists, cpu), 0, sizeof(mpc_hists));
+
+    pr_info("mpc: stats: latency histograms reset\n");
+    return count;
+}
+
+static const struct file_operations mpc_stats_fops = {
+        .owner = THIS_MODULE,
+        .open = mpc_stats_open,
+        .read = seq_read,
+        .llseek = seq_lseek,
+        .write = mpc_stats_write,
+        .release = single_release
+};
+
+// *****************************************************************************
+// *                            INIT/CLEANUP IMPLEMENTATION                    *
+// *****************************************************************************
+
+void mpc_stats_init(void) {
+    // debugfs errors are not fatal, the driver works without it
+    mpc_debugfs = debugfs_create_dir(MPC_DRIVER_NAME, NULL);
+    debugfs_create_file("latency", 0600, mpc_debugfs, NULL, &mpc_stats_fops);
+}
+
+void mpc_stats_cleanup(void) {
+    debugfs_remove_recursive(mpc_debugfs);
+    mpc_debugfs = NULL;
+}
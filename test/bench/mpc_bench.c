@@ -0,0 +1,359 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <fcntl.h>                  // open
+#include <unistd.h>                 // read, write
+#include <sys/ioctl.h>              // ioctl
+#include <sys/utsname.h>            // uname
+
+#include "../../mpc/include/rtc.h"
+
+#define MB (1024.0 * 1024.0)
+#define MAX_LIST 16                 // values on a -t, -p or -m list
+#define MD5_BUDGET (256L << 20)     // bytes hashed per message size, at most
+
+static char *stack_dev = "/dev/stack0";
+static char *md5_dev = "/dev/md5";
+static char *rtc_dev = "/dev/RTC";
+static char *tests = "stack,md5,rtc";
+static long  ops = 20000;           // operations per thread and test
+
+static long threads[MAX_LIST] = {1, 2, 4, 8};
+static int  nthreads = 4;
+static long payloads[MAX_LIST] = {8, 64, 512, 4096, 65536};
+static int  npayloads = 5;
+static long messages[MAX_LIST] = {64, 1024, 65536, 1048576};
+static int  nmessages = 4;
+
+/**
+ * A stack benchmark thread.
+ */
+struct worker {
+    pthread_t tid;
+    long payload;           ///< Bytes per push and pop
+    long *push_ns;          ///< Latency of every push
+    long *pop_ns;           ///< Latency of every pop
+    long done;              ///< Push/pop pairs done
+    long bytes;             ///< Bytes pushed and popped
+};
+
+static pthread_barrier_t start;
+
+/**
+ * Current time in nanoseconds.
+ */
+static long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b) {
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print the latency percentiles of 'n' samples as a JSON object. The
+ * samples are sorted.
+ */
+static void print_latency(const char *name, long *ns, long n) {
+    qsort(ns, n, sizeof(long), cmp_long);
+
+    if (!n) {
+        printf("\"%s\": null", name);
+        return;
+    }
+    printf("\"%s\": {\"p50\": %ld, \"p90\": %ld, \"p99\": %ld, \"p999\": %ld, \"max\": %ld}", name,
+           ns[n * 50 / 100], ns[n * 90 / 100], ns[n * 99 / 100], ns[n * 999 / 1000], ns[n - 1]);
+}
+
+/**
+ * Parse a comma separated list of numbers.
+ */
+static int parse_list(char *arg, long *list) {
+    int n = 0;
+    char *tok;
+
+    for (tok = strtok(arg, ","); tok && n < MAX_LIST; tok = strtok(NULL, ","))
+        if ((list[n] = atol(tok)) > 0)
+            n++;
+    return n;
+}
+
+// *****************************************************************************
+// *                            STACK                                          *
+// *****************************************************************************
+
+/**
+ * Push and pop 'payload' bytes 'ops' times, timing every call.
+ */
+static void *stack_worker(void *arg) {
+    struct worker *w = arg;
+    char *buf = calloc(1, w->payload);
+    int fd = open(stack_dev, O_RDWR);
+    long t0, t1, t2;
+    ssize_t n;
+
+    pthread_barrier_wait(&start);
+
+    for (w->done = 0; fd >= 0 && buf && w->done < ops; w->done++) {
+        t0 = now_ns();
+        if (write(fd, buf, w->payload) != w->payload)
+            break;
+        t1 = now_ns();
+        // other threads may have taken part of it
+        if ((n = read(fd, buf, w->payload)) < 0)
+            break;
+        t2 = now_ns();
+
+        w->push_ns[w->done] = t1 - t0;
+        w->pop_ns[w->done] = t2 - t1;
+        w->bytes += w->payload + n;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    free(buf);
+    return NULL;
+}
+
+/**
+ * One stack run, 'nt' threads pushing and popping 'payload' bytes on the
+ * same stack.
+ */
+static int stack_run(long nt, long payload, int last) {
+    struct worker *w = calloc(nt, sizeof(struct worker));
+    long *push_ns = malloc(nt * ops * sizeof(long));
+    long *pop_ns = malloc(nt * ops * sizeof(long));
+    long t0, t1, done = 0, bytes = 0, i;
+
+    if (!w || !push_ns || !pop_ns) {
+        fprintf(stderr, "Error allocating memory\n");
+        return -1;
+    }
+
+    pthread_barrier_init(&start, NULL, nt + 1);
+    for (i = 0; i < nt; i++) {
+        w[i].payload = payload;
+        w[i].push_ns = push_ns + i * ops;
+        w[i].pop_ns = pop_ns + i * ops;
+        pthread_create(&w[i].tid, NULL, stack_worker, &w[i]);
+    }
+
+    pthread_barrier_wait(&start);
+    t0 = now_ns();
+    for (i = 0; i < nt; i++)
+        pthread_join(w[i].tid, NULL);
+    t1 = now_ns();
+    pthread_barrier_destroy(&start);
+
+    // pack the samples of every thread together
+    for (i = 0; i < nt; i++) {
+        memmove(push_ns + done, w[i].push_ns, w[i].done * sizeof(long));
+        memmove(pop_ns + done, w[i].pop_ns, w[i].done * sizeof(long));
+        done += w[i].done;
+        bytes += w[i].bytes;
+    }
+
+    if (done < nt * ops)
+        fprintf(stderr, "Error on %s push/pop (%ld threads, %ld bytes)\n", stack_dev, nt, payload);
+
+    printf("    {\"threads\": %ld, \"payload\": %ld, \"ops\": %ld, \"ops_per_s\": %.0f, \"mb_per_s\": %.1f,\n     ",
+           nt, payload, 2 * done, 2 * done / ((t1 - t0) / 1e9), bytes / MB / ((t1 - t0) / 1e9));
+    print_latency("push_ns", push_ns, done);
+    printf(",\n     ");
+    print_latency("pop_ns", pop_ns, done);
+    printf("}%s\n", last ? "" : ",");
+
+    free(w);
+    free(push_ns);
+    free(pop_ns);
+    return done < nt * ops ? -1 : 0;
+}
+
+static void stack_bench(void) {
+    int i, j;
+
+    printf("  \"stack\": {\"device\": \"%s\", \"runs\": [\n", stack_dev);
+    for (i = 0; i < nthreads; i++)
+        for (j = 0; j < npayloads; j++)
+            stack_run(threads[i], payloads[j], i == nthreads - 1 && j == npayloads - 1);
+    printf("  ]}");
+}
+
+// *****************************************************************************
+// *                            MD5                                            *
+// *****************************************************************************
+
+/**
+ * Hash 'size' bytes messages, timing every write and digest read.
+ */
+static int md5_run(int fd, long size, int last) {
+    long n = MD5_BUDGET / size, i, t0, t1, start, end;
+    unsigned char digest[16];
+    char *msg;
+    long *ns;
+
+    // big messages get fewer rounds
+    if (n > ops)
+        n = ops;
+    if (n < 1)
+        n = 1;
+
+    msg = calloc(1, size);
+    ns = malloc(n * sizeof(long));
+    if (!msg || !ns) {
+        fprintf(stderr, "Error allocating memory\n");
+        return -1;
+    }
+
+    start = now_ns();
+    for (i = 0; i < n; i++) {
+        t0 = now_ns();
+        if (write(fd, msg, size) != size || read(fd, digest, sizeof(digest)) != sizeof(digest))
+            break;
+        t1 = now_ns();
+        ns[i] = t1 - t0;
+    }
+    end = now_ns();
+
+    if (i < n)
+        fprintf(stderr, "Error hashing on %s (%ld bytes)\n", md5_dev, size);
+
+    printf("    {\"size\": %ld, \"digests\": %ld, \"digests_per_s\": %.0f, \"mb_per_s\": %.1f,\n     ",
+           size, i, i / ((end - start) / 1e9), i * size / MB / ((end - start) / 1e9));
+    print_latency("digest_ns", ns, i);
+    printf("}%s\n", last ? "" : ",");
+
+    free(msg);
+    free(ns);
+    return i < n ? -1 : 0;
+}
+
+static void md5_bench(void) {
+    int fd, i;
+
+    // the device needs a controlling terminal
+    if ((fd = open(md5_dev, O_RDWR)) < 0) {
+        fprintf(stderr, "Error opening %s\n", md5_dev);
+        printf("  \"md5\": null");
+        return;
+    }
+
+    printf("  \"md5\": {\"device\": \"%s\", \"runs\": [\n", md5_dev);
+    for (i = 0; i < nmessages; i++)
+        md5_run(fd, messages[i], i == nmessages - 1);
+    printf("  ]}");
+
+    close(fd);
+}
+
+// *****************************************************************************
+// *                            RTC                                            *
+// *****************************************************************************
+
+static void rtc_bench(void) {
+    long *ns = malloc(ops * sizeof(long));
+    long i, t0, t1, start, end;
+    unsigned char value;
+    int fd;
+
+    if (!ns || (fd = open(rtc_dev, O_RDONLY)) < 0) {
+        fprintf(stderr, "Error opening %s\n", rtc_dev);
+        printf("  \"rtc\": null");
+        free(ns);
+        return;
+    }
+
+    start = now_ns();
+    for (i = 0; i < ops; i++) {
+        t0 = now_ns();
+        if (ioctl(fd, RTC_READ_SECONDS, &value) < 0)
+            break;
+        t1 = now_ns();
+        ns[i] = t1 - t0;
+    }
+    end = now_ns();
+
+    if (i < ops)
+        fprintf(stderr, "Error reading %s\n", rtc_dev);
+
+    printf("  \"rtc\": {\"device\": \"%s\", \"reads\": %ld, \"reads_per_s\": %.0f,\n   ", rtc_dev, i,
+           i / ((end - start) / 1e9));
+    print_latency("read_ns", ns, i);
+    printf("}");
+
+    close(fd);
+    free(ns);
+}
+
+/**
+ * Benchmark the mpc devices and print the results as JSON.
+ */
+int main(int argc, char *argv[]) {
+    struct utsname uts;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:r:T:n:t:p:M:")) != -1) {
+        switch (opt) {
+            case 's': stack_dev = optarg;                           break;
+            case 'm': md5_dev = optarg;                             break;
+            case 'r': rtc_dev = optarg;                             break;
+            case 'T': tests = optarg;                               break;
+            case 'n': ops = atol(optarg);                           break;
+            case 't': nthreads = parse_list(optarg, threads);       break;
+            case 'p': npayloads = parse_list(optarg, payloads);     break;
+            case 'M': nmessages = parse_list(optarg, messages);     break;
+            default:
+                fprintf(stderr, "usage: %s [-s stack] [-m md5] [-r rtc] [-T stack,md5,rtc] [-n ops]\n"
+                                "       [-t threads,...] [-p payload,...] [-M message,...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (ops < 1 || !nthreads || !npayloads || !nmessages) {
+        fprintf(stderr, "Error: empty test\n");
+        return 1;
+    }
+
+    uname(&uts);
+    printf("{\n  \"kernel\": \"%s\", \"machine\": \"%s\", \"cpus\": %ld, \"ops\": %ld",
+           uts.release, uts.machine, sysconf(_SC_NPROCESSORS_ONLN), ops);
+
+    if (strstr(tests, "stack")) {
+        printf(",\n");
+        stack_bench();
+    }
+    if (strstr(tests, "md5")) {
+        printf(",\n");
+        md5_bench();
+    }
+    if (strstr(tests, "rtc")) {
+        printf(",\n");
+        rtc_bench();
+    }
+
+    printf("\n}\n");
+    return 0;
+}
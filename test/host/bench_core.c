@@ -0,0 +1,139 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Microbenchmarks of the driver core in user space, in CPU cycles. The
+// md5 core is run next to OpenSSL on the same messages. Output is JSON.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <openssl/evp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "mpc_core.h"
+
+#define REPS    7                   // best of
+#define BUDGET  (64L << 20)         // bytes hashed per message size and rep
+#define POLICY_OPS 1000000
+
+static const size_t messages[] = {64, 1024, 16384, 1048576};
+
+/**
+ * Cycle counter. The TSC on x86, fenced so earlier work is done before it
+ * is read; nanoseconds anywhere else.
+ */
+static inline uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static volatile size_t sink;        // keeps results alive
+
+/**
+ * Cycles per byte hashing 'len' bytes messages, with the core or OpenSSL.
+ */
+static double md5_run(const uint8_t *msg, size_t len, int openssl) {
+    uint8_t digest[MD5_HASH_SIZE];
+    struct mpc_md5_ctx ctx;
+    long n = BUDGET / len, i;
+    uint64_t t, best = UINT64_MAX;
+    int rep;
+
+    for (rep = 0; rep < REPS; rep++) {
+        t = cycles();
+        for (i = 0; i < n; i++) {
+            if (openssl) {
+                EVP_Digest(msg, len, digest, NULL, EVP_md5(), NULL);
+            } else {
+                mpc_md5_reset(&ctx);
+                mpc_md5_update(&ctx, msg, len);
+                mpc_md5_final(&ctx, digest);
+            }
+            sink += digest[0];
+        }
+        t = cycles() - t;
+        best = min(best, t);
+    }
+
+    return (double) best / ((double) n * len);
+}
+
+/**
+ * Cycles per call of a buffer size policy function, on pseudo random sizes.
+ */
+static double policy_run(int which) {
+    uint64_t t, best = UINT64_MAX;
+    size_t x, acc;
+    int rep;
+    long i;
+
+    for (rep = 0; rep < REPS; rep++) {
+        x = 88172645463325252ULL;
+        acc = 0;
+        t = cycles();
+        for (i = 0; i < POLICY_OPS; i++) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            switch (which) {
+            case 0: acc += mpc_stack_grow_size(x & 0xFFFFFF, 1 << 23); break;
+            case 1: acc += mpc_stack_shrink_size(x & 0xFFFFFF); break;
+            case 2: acc += mpc_stack_underloaded(x & 0xFFFFFF, x >> 40 & 0xFFFF); break;
+            default: acc += mpc_stack_cold_bytes(x & 0xFFFFFF, 1 << 20, 65536); break;
+            }
+        }
+        t = cycles() - t;
+        sink += acc;
+        best = min(best, t);
+    }
+
+    return (double) best / POLICY_OPS;
+}
+
+int main(void) {
+    static const char *policies[] = {"grow_size", "shrink_size", "underloaded", "cold_bytes"};
+    size_t nmsg = sizeof(messages) / sizeof(messages[0]), i;
+    uint8_t *msg = malloc(messages[nmsg - 1]);
+
+    if (!msg)
+        return 1;
+    for (i = 0; i < messages[nmsg - 1]; i++)
+        msg[i] = i * 7 + 3;
+
+#if defined(__x86_64__) || defined(__i386__)
+    printf("{\"unit\": \"cycles\",\n \"md5\": [");
+#else
+    printf("{\"unit\": \"ns\",\n \"md5\": [");
+#endif
+    for (i = 0; i < nmsg; i++) {
+        printf("%s\n  {\"message\": %zu, \"core_per_byte\": %.3f, \"openssl_per_byte\": %.3f}",
+               i ? "," : "", messages[i], md5_run(msg, messages[i], 0), md5_run(msg, messages[i], 1));
+    }
+    printf("],\n \"stack_policy\": {");
+    for (i = 0; i < 4; i++)
+        printf("%s\"%s\": %.2f", i ? ", " : "", policies[i], policy_run(i));
+    printf("}}\n");
+
+    free(msg);
+    return 0;
+}
@@ -0,0 +1,40 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+// BCD2BIN() against the byte printed in hex and read back as decimal, on
+// the values the CMOS clock registers can hold.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mpc_core.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char hex[3];
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        uint8_t bcd = data[i];
+
+        // the hex digits of a BCD byte are its decimal digits
+        snprintf(hex, sizeof(hex), "%02x", bcd);
+        if (hex[0] > '9' || hex[1] > '9')
+            continue;
+        if (BCD2BIN(bcd) != strtol(hex, NULL, 10))
+            abort();
+    }
+
+    return 0;
+}
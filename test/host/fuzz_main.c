@@ -0,0 +1,77 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Standalone driver for the libFuzzer harnesses, for hosts without
+// libFuzzer. Runs every file given, or '-runs=N' random inputs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+#define MAX_INPUT 65536
+
+static int run_file(const char *path) {
+    static uint8_t data[MAX_INPUT];
+    size_t size;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    size = fread(data, 1, sizeof(data), f);
+    fclose(f);
+
+    LLVMFuzzerTestOneInput(data, size);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static uint8_t data[MAX_INPUT];
+    unsigned long runs = 10000, seed = 1, i;
+    size_t size, j;
+    int files = 0, a;
+
+    for (a = 1; a < argc; a++) {
+        if (!strncmp(argv[a], "-runs=", 6))
+            runs = strtoul(argv[a] + 6, NULL, 10);
+        else if (!strncmp(argv[a], "-seed=", 6))
+            seed = strtoul(argv[a] + 6, NULL, 10);
+        else if (argv[a][0] != '-') {
+            if (run_file(argv[a]))
+                return 1;
+            files++;
+        }
+    }
+
+    if (files)
+        return 0;
+
+    srandom(seed);
+    for (i = 0; i < runs; i++) {
+        // mostly short inputs, some long enough to cross several blocks
+        size = random() % (i % 16 ? 256 : MAX_INPUT);
+        for (j = 0; j < size; j++)
+            data[j] = random();
+        LLVMFuzzerTestOneInput(data, size);
+    }
+
+    printf("%s: %lu runs ok\n", argv[0], runs);
+    return 0;
+}
@@ -0,0 +1,48 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Differential test of the md5 core against OpenSSL. The input is fed to
+// mpc_md5_update() in pieces, cut where the input itself says.
+
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+#include "mpc_core.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    uint8_t digest[MD5_HASH_SIZE], ref[MD5_HASH_SIZE];
+    struct mpc_md5_ctx ctx;
+    size_t off = 0, n;
+    uint8_t cut;
+
+    if (!EVP_Digest(data, size, ref, NULL, EVP_md5(), NULL))
+        abort();
+
+    mpc_md5_reset(&ctx);
+    while (off < size) {
+        // the first byte of each piece is its length too
+        cut = data[off];
+        n = min_t(size_t, size - off, cut ? cut : 64);
+        mpc_md5_update(&ctx, data + off, n);
+        off += n;
+    }
+    mpc_md5_final(&ctx, digest);
+
+    if (memcmp(digest, ref, MD5_HASH_SIZE))
+        abort();
+
+    return 0;
+}
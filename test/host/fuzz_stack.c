@@ -0,0 +1,88 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+// Replays pushes, pops and limit changes through the stack buffer size
+// policy, the way stack.c applies it, and checks the buffer always holds
+// the data and the data never goes over the limit.
+
+#include <stdlib.h>
+
+#include "mpc_core.h"
+
+#define STACK_LIMIT_MAX (1UL << 34)
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    size_t psize, lsize = 0, limit, n, next, cold;
+    size_t i;
+
+    if (size < 2)
+        return 0;
+
+    // first two bytes pick the limit, 0 = no limit
+    limit = ((size_t) (data[0] | data[1] << 8) << (data[1] >> 4 << 1)) % STACK_LIMIT_MAX;
+
+    // open() sizes the buffer for STACK_MIN_SIZE bytes, whatever the limit
+    psize = mpc_stack_grow_size(STACK_MIN_SIZE, limit);
+
+    for (i = 2; i + 1 < size; i += 2) {
+        // a length byte, then the operation and a shift for the length,
+        // only sizes are modeled so they go up to hundreds of GiB
+        n = (size_t) data[i] << (data[i + 1] & 0x1F);
+
+        if (data[i + 1] & 0x80) {
+            // pop
+            lsize -= min(n, lsize);
+            if (mpc_stack_underloaded(psize, lsize)) {
+                next = mpc_stack_shrink_size(psize);
+                if (next > psize || next < STACK_MIN_SIZE || next < lsize)
+                    abort();
+                psize = next;
+            }
+        } else if (data[i + 1] & 0x40) {
+            // STACK_SET_LIMIT, refused under the contents
+            if (!n || n >= lsize)
+                limit = n;
+            continue;
+        } else if (mpc_stack_over_limit(lsize, n, limit)) {
+            // push over the limit, even when the buffer has room
+            if (!limit || lsize + n <= limit)
+                abort();
+            continue;
+        } else if (lsize + n > psize) {
+            // push that grows the buffer
+            next = mpc_stack_grow_size(lsize + n, limit);
+            if (next < lsize + n || (limit && next > limit))
+                abort();
+            if (!limit && next <= STACK_GROW_STEP && (next & (next - 1)))
+                abort();
+            if (next > STACK_MAX_SIZE && next != lsize + n)
+                abort();
+            psize = next;
+            lsize += n;
+        } else {
+            lsize += n;
+        }
+
+        if (lsize > psize || (limit && lsize > limit))
+            abort();
+
+        cold = mpc_stack_cold_bytes(lsize, n, STACK_MIN_SIZE);
+        if (cold % STACK_MIN_SIZE || (cold && cold + n > lsize) ||
+            lsize - cold >= n + STACK_MIN_SIZE)
+            abort();
+    }
+
+    return 0;
+}
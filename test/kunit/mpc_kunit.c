@@ -0,0 +1,599 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include <kunit/test.h>
+
+// the driver sources are built in, so their static functions are reachable
+#include "../../mpc/src/stack.c"
+#include "../../mpc/src/md5.c"
+#include "../../mpc/src/stack_core.c"
+#include "../../mpc/src/md5_core.c"
+#include "../../mpc/src/stats.c"
+
+// *****************************************************************************
+// *                            STACK                                          *
+// *****************************************************************************
+
+/**
+ * Push kernel memory through the same reserve/commit path as write().
+ */
+static int push(struct stack *dev, const void *data, size_t len) {
+    struct stack_resv resv;
+    int err;
+
+    if ((err = stack_push_begin(dev, len, 0, &resv)))
+        return err;
+    err = stack_from_kernel(dev, resv.pos, data, len);
+    stack_push_end(dev, &resv, err);
+    return err;
+}
+
+/**
+ * Copy 'len' bytes of the storage at 'pos' to kernel memory.
+ */
+static int peek_storage(struct stack *dev, size_t pos, void *data, size_t len) {
+    struct stack_seg seg;
+    int err;
+
+    while (len) {
+        if ((err = stack_seg_get(dev, pos, len, &seg)))
+            return err;
+        memcpy(data, seg.addr, seg.len);
+        stack_seg_put(&seg, false);
+
+        data += seg.len;
+        pos += seg.len;
+        len -= seg.len;
+    }
+
+    return 0;
+}
+
+/**
+ * Pop to kernel memory through the same reserve/commit path as read().
+ */
+static ssize_t pop(struct stack *dev, void *data, size_t len) {
+    struct stack_resv resv;
+    ssize_t ret;
+    int err;
+
+    if ((ret = stack_pop_begin(dev, len, 0, &resv)) <= 0)
+        return ret;
+    err = peek_storage(dev, resv.pos, data, ret);
+    stack_pop_end(dev, &resv, err);
+    return err ? err : ret;
+}
+
+/**
+ * Fill 'len' bytes with a pattern that depends on 'seed'.
+ */
+static void fill(u8 *data, size_t len, unsigned int seed) {
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        data[i] = (i * 7 + seed) % 251;
+}
+
+/**
+ * A stack as stack_open() leaves it.
+ */
+static int mpc_stack_test_init(struct kunit *test) {
+    struct stack *dev = stack_alloc(0);
+
+    if (!dev)
+        return -ENOMEM;
+    if (increase_buffer(dev, STACK_MIN_SIZE)) {
+        kref_put(&dev->ref, stack_free);
+        return -ENOMEM;
+    }
+
+    test->priv = dev;
+    return 0;
+}
+
+static void mpc_stack_test_exit(struct kunit *test) {
+    struct stack *dev = test->priv;
+
+    kref_put(&dev->ref, stack_free);
+    cold_depth = 0;
+    cold_chunk = STACK_COLD_CHUNK;
+}
+
+static void mpc_stack_push_pop(struct kunit *test) {
+    struct stack *dev = test->priv;
+    char buf[16];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "abc", 3), 0);
+    KUNIT_ASSERT_EQ(test, push(dev, "defg", 4), 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 7);
+
+    // last in, first out
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, 4), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "defg", 4), 0);
+
+    // no more than what is left
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 3);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "abc", 3), 0);
+
+    // an empty stack reads nothing
+    KUNIT_EXPECT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 0);
+}
+
+static void mpc_stack_empty_push(struct kunit *test) {
+    struct stack *dev = test->priv;
+
+    KUNIT_EXPECT_EQ(test, push(dev, "", 0), 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) STACK_MIN_SIZE);
+}
+
+static void mpc_stack_empty_pop(struct kunit *test) {
+    struct stack *dev = test->priv;
+    char buf[4];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "abc", 3), 0);
+    KUNIT_EXPECT_EQ(test, pop(dev, buf, 0), (ssize_t) 0);
+    KUNIT_EXPECT_TRUE(test, stack_idle(dev));
+
+    // nothing left reserved to hold the next push and pop
+    KUNIT_ASSERT_EQ(test, push(dev, "d", 1), 0);
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "abcd", 4), 0);
+}
+
+static void mpc_stack_grow(struct kunit *test) {
+    struct stack *dev = test->priv;
+    u8 *data = kunit_kzalloc(test, 3 * STACK_MIN_SIZE, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+
+    // a full buffer doesn't grow
+    KUNIT_ASSERT_EQ(test, push(dev, data, STACK_MIN_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) STACK_MIN_SIZE);
+
+    // one more byte doubles it
+    KUNIT_ASSERT_EQ(test, push(dev, data, 1), 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 2 * STACK_MIN_SIZE);
+
+    // to the next power of two
+    KUNIT_ASSERT_EQ(test, push(dev, data, 3 * STACK_MIN_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) roundup_pow_of_two(4 * STACK_MIN_SIZE + 1));
+
+    // big buffers grow a step at a time, and never past what kvmalloc gives
+    KUNIT_EXPECT_EQ(test, mpc_stack_grow_size((1UL << 30) + 1, 0), (size_t) 5 << 28);
+    KUNIT_EXPECT_EQ(test, mpc_stack_grow_size(STACK_MAX_SIZE - 1, 0), (size_t) STACK_MAX_SIZE);
+    KUNIT_EXPECT_EQ(test, realloc_buffer(dev, STACK_MAX_SIZE + 1), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) roundup_pow_of_two(4 * STACK_MIN_SIZE + 1));
+}
+
+static void mpc_stack_limit(struct kunit *test) {
+    struct stack *dev = test->priv;
+    u8 *data = kunit_kzalloc(test, 1024, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+    dev->limit = 1000;
+
+    // the buffer never grows over the limit
+    KUNIT_ASSERT_EQ(test, push(dev, data, 600), 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 1000);
+
+    KUNIT_EXPECT_EQ(test, push(dev, data, 401), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 600);
+
+    KUNIT_EXPECT_EQ(test, push(dev, data, 400), 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 1000);
+}
+
+static void mpc_stack_limit_lowered(struct kunit *test) {
+    struct stack *dev = test->priv;
+    u8 *data = kunit_kzalloc(test, 1024, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+    KUNIT_ASSERT_EQ(test, push(dev, data, 600), 0);
+    KUNIT_ASSERT_EQ(test, dev->psize, (size_t) 1024);
+
+    // lowered under the buffer size, as STACK_SET_LIMIT allows
+    dev->limit = 700;
+    KUNIT_EXPECT_EQ(test, push(dev, data, 101), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, push(dev, data, 100), 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 700);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 1024);
+
+    // under STACK_MIN_SIZE, the buffer keeps its minimum size
+    KUNIT_ASSERT_EQ(test, pop(dev, data, 700), (ssize_t) 700);
+    dev->limit = 100;
+    KUNIT_EXPECT_EQ(test, push(dev, data, 101), -ENOSPC);
+    KUNIT_EXPECT_EQ(test, push(dev, data, 100), 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 100);
+}
+
+static void mpc_stack_shrink(struct kunit *test) {
+    struct stack *dev = test->priv;
+    u8 *data = kunit_kzalloc(test, 4096, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, data);
+    KUNIT_ASSERT_EQ(test, push(dev, data, 4096), 0);
+    KUNIT_ASSERT_EQ(test, dev->psize, (size_t) 4096);
+
+    // halved once per pop while the load is under 1/STACK_MIN_LOAD
+    KUNIT_ASSERT_EQ(test, pop(dev, data, 4096 - 100), (ssize_t) (4096 - 100));
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 2048);
+    KUNIT_ASSERT_EQ(test, pop(dev, data, 50), (ssize_t) 50);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 1024);
+
+    // an empty stack keeps its buffer
+    KUNIT_ASSERT_EQ(test, pop(dev, data, 50), (ssize_t) 50);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) 1024);
+
+    // never under STACK_MIN_SIZE
+    KUNIT_ASSERT_EQ(test, realloc_buffer(dev, STACK_MIN_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, decrease_buffer(dev), 0);
+    KUNIT_EXPECT_EQ(test, dev->psize, (size_t) STACK_MIN_SIZE);
+}
+
+static void mpc_stack_push_fault(struct kunit *test) {
+    struct stack *dev = test->priv;
+    struct stack_resv a, b;
+    char buf[8];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "xy", 2), 0);
+
+    // two pushes in flight, the first one fails after the second committed
+    KUNIT_ASSERT_EQ(test, stack_push_begin(dev, 3, 0, &a), 0);
+    KUNIT_ASSERT_EQ(test, stack_push_begin(dev, 2, 0, &b), 0);
+    KUNIT_ASSERT_EQ(test, stack_from_kernel(dev, b.pos, "de", 2), 0);
+    stack_push_end(dev, &b, 0);
+    stack_push_end(dev, &a, -EFAULT);
+
+    KUNIT_ASSERT_EQ(test, stack_size(dev), (size_t) 4);
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "xyde", 4), 0);
+}
+
+static void mpc_stack_pop_fault(struct kunit *test) {
+    struct stack *dev = test->priv;
+    struct stack_resv a, b;
+    char buf[8];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "abcdef", 6), 0);
+
+    // two pops in flight, the first one fails after the second committed
+    KUNIT_ASSERT_EQ(test, stack_pop_begin(dev, 2, 0, &a), (ssize_t) 2);
+    KUNIT_ASSERT_EQ(test, stack_pop_begin(dev, 2, 0, &b), (ssize_t) 2);
+    stack_pop_end(dev, &b, 0);
+    stack_pop_end(dev, &a, -EFAULT);
+
+    // its bytes are back on top
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "abef", 4), 0);
+}
+
+static void mpc_stack_push_fault_deferred(struct kunit *test) {
+    struct stack *dev = test->priv;
+    struct stack_resv a, b;
+    char buf[8];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "xy", 2), 0);
+
+    // the first push fails while the second is still copying: no waiting,
+    // the hole is filled when the second one commits
+    KUNIT_ASSERT_EQ(test, stack_push_begin(dev, 3, 0, &a), 0);
+    KUNIT_ASSERT_EQ(test, stack_push_begin(dev, 2, 0, &b), 0);
+    stack_push_end(dev, &a, -EFAULT);
+    KUNIT_EXPECT_FALSE(test, stack_idle(dev));
+
+    KUNIT_ASSERT_EQ(test, stack_from_kernel(dev, b.pos, "de", 2), 0);
+    stack_push_end(dev, &b, 0);
+    KUNIT_EXPECT_TRUE(test, stack_idle(dev));
+
+    KUNIT_ASSERT_EQ(test, stack_size(dev), (size_t) 4);
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "xyde", 4), 0);
+}
+
+static void mpc_stack_pop_fault_deferred(struct kunit *test) {
+    struct stack *dev = test->priv;
+    struct stack_resv a, b;
+    char buf[8];
+
+    KUNIT_ASSERT_EQ(test, push(dev, "abcdef", 6), 0);
+
+    // the first pop fails while the second is still copying
+    KUNIT_ASSERT_EQ(test, stack_pop_begin(dev, 2, 0, &a), (ssize_t) 2);
+    KUNIT_ASSERT_EQ(test, stack_pop_begin(dev, 2, 0, &b), (ssize_t) 2);
+    stack_pop_end(dev, &a, -EFAULT);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), (size_t) 2);
+
+    stack_pop_end(dev, &b, 0);
+    KUNIT_EXPECT_TRUE(test, stack_idle(dev));
+
+    // its bytes are back on top
+    KUNIT_ASSERT_EQ(test, pop(dev, buf, sizeof(buf)), (ssize_t) 4);
+    KUNIT_EXPECT_EQ(test, memcmp(buf, "abef", 4), 0);
+}
+
+static void mpc_stack_shmem(struct kunit *test) {
+    struct stack *dev = test->priv;
+    size_t len = 3 * PAGE_SIZE + 17, off;
+    u8 *in = kunit_kmalloc(test, len, GFP_KERNEL);
+    u8 *out = kunit_kzalloc(test, len, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, in);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, out);
+    KUNIT_ASSERT_EQ(test, stack_set_backing(dev, STACK_BACKING_SHMEM), 0L);
+    fill(in, len, 1);
+
+    KUNIT_ASSERT_EQ(test, push(dev, in, len), 0);
+
+    // pops across page boundaries
+    for (off = len; off; off -= min_t(size_t, off, 1000))
+        KUNIT_ASSERT_EQ(test, pop(dev, out + off - min_t(size_t, off, 1000), min_t(size_t, off, 1000)),
+                        (ssize_t) min_t(size_t, off, 1000));
+
+    KUNIT_EXPECT_EQ(test, memcmp(in, out, len), 0);
+}
+
+static void mpc_stack_cold(struct kunit *test) {
+    struct stack *dev = test->priv;
+    size_t len = 16 * 1024, off;
+    u8 *in = kunit_kmalloc(test, len, GFP_KERNEL);
+    u8 *out = kunit_kzalloc(test, len, GFP_KERNEL);
+
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, in);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, out);
+    fill(in, len, 2);
+
+    cold_depth = 1024;
+    cold_chunk = 4096;
+    dev->limit = len;
+    for (off = 0; off < len; off += 1024)
+        KUNIT_ASSERT_EQ(test, push(dev, in + off, 1024), 0);
+
+    if (!dev->tfm)
+        kunit_skip(test, "no %s compressor", cold_alg);
+
+    KUNIT_EXPECT_GT(test, dev->csize, (size_t) 0);
+    KUNIT_EXPECT_EQ(test, stack_size(dev), len);
+
+    // cold bytes count against the limit, though the buffer has room
+    KUNIT_EXPECT_EQ(test, push(dev, in, 1), -ENOSPC);
+
+    // pops thaw the chunks back, even on a full stack
+    for (off = len; off; off -= 1024)
+        KUNIT_ASSERT_EQ(test, pop(dev, out + off - 1024, 1024), (ssize_t) 1024);
+
+    KUNIT_EXPECT_EQ(test, memcmp(in, out, len), 0);
+    KUNIT_EXPECT_EQ(test, dev->csize, (size_t) 0);
+}
+
+static struct kunit_case mpc_stack_cases[] = {
+    KUNIT_CASE(mpc_stack_push_pop),
+    KUNIT_CASE(mpc_stack_empty_push),
+    KUNIT_CASE(mpc_stack_empty_pop),
+    KUNIT_CASE(mpc_stack_grow),
+    KUNIT_CASE(mpc_stack_limit),
+    KUNIT_CASE(mpc_stack_limit_lowered),
+    KUNIT_CASE(mpc_stack_shrink),
+    KUNIT_CASE(mpc_stack_push_fault),
+    KUNIT_CASE(mpc_stack_pop_fault),
+    KUNIT_CASE(mpc_stack_push_fault_deferred),
+    KUNIT_CASE(mpc_stack_pop_fault_deferred),
+    KUNIT_CASE(mpc_stack_shmem),
+    KUNIT_CASE(mpc_stack_cold),
+    {}
+};
+
+static struct kunit_suite mpc_stack_suite = {
+    .name = "mpc-stack",
+    .init = mpc_stack_test_init,
+    .exit = mpc_stack_test_exit,
+    .test_cases = mpc_stack_cases,
+};
+
+// *****************************************************************************
+// *                            MD5                                            *
+// *****************************************************************************
+
+/**
+ * Digest 'len' bytes of 'data', fed 'step' bytes at a time (0 = at once).
+ */
+static void digest(const void *data, size_t len, size_t step, u8 *out) {
+    struct mpc_md5_ctx ctx;
+
+    mpc_md5_reset(&ctx);
+    for (; step && len > step; data += step, len -= step)
+        mpc_md5_update(&ctx, data, step);
+    mpc_md5_update(&ctx, data, len);
+    mpc_md5_final(&ctx, out);
+}
+
+/**
+ * Hexadecimal form of a digest.
+ */
+static void hex(const u8 *digest, char *out) {
+    int i;
+
+    for (i = 0; i < MD5_HASH_SIZE; i++)
+        sprintf(out + 2 * i, "%02x", digest[i]);
+}
+
+static const struct {
+    const char *msg;
+    const char *md5;
+} md5_vectors[] = {
+    // RFC 1321, appendix A.5
+    {"", "d41d8cd98f00b204e9800998ecf8427e"},
+    {"a", "0cc175b9c0f1b6a831c399e269772661"},
+    {"abc", "900150983cd24fb0d6963f7d28e17f72"},
+    {"message digest", "f96b697d7cb7938d525a2f31aaf161d0"},
+    {"abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"},
+    {"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f"},
+    {"12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+     "57edf4a22be3c955ac49da2e2107b67a"},
+};
+
+// fill(data, len, 0) around the padding boundaries: the length fits on the
+// last chunk up to 55 bytes, 56 to 63 need one more chunk
+static const struct {
+    size_t len;
+    const char *md5;
+} md5_boundaries[] = {
+    {55, "a3c81137436036ad8b477da25301a150"},
+    {56, "64c7901679c62fee89dae9fdc90f6cdc"},
+    {57, "de3640741df50a25ebfbf7bfad1df856"},
+    {63, "ca2a2c51613f550d77bfa700fa71b2f3"},
+    {64, "c1e181645d10867b9810b9ab454f39fd"},
+    {65, "8ce7034cd47c2e5766f920d9f6cd25b2"},
+    {119, "bbee0fa54927be9cec551823419525d6"},
+    {120, "bec94d18929378fdb98c26a97f1dba72"},
+    {128, "3eba58a155f6aa0ef467626f0e78d53b"},
+};
+
+static void mpc_md5_vectors(struct kunit *test) {
+    u8 out[MD5_HASH_SIZE];
+    char str[2 * MD5_HASH_SIZE + 1];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(md5_vectors); i++) {
+        digest(md5_vectors[i].msg, strlen(md5_vectors[i].msg), 0, out);
+        hex(out, str);
+        KUNIT_EXPECT_STREQ_MSG(test, str, md5_vectors[i].md5, "message \"%s\"", md5_vectors[i].msg);
+    }
+}
+
+static void mpc_md5_boundaries(struct kunit *test) {
+    static const size_t steps[] = {0, 1, 13, 55, 56, 64};
+    u8 data[128], out[MD5_HASH_SIZE];
+    char str[2 * MD5_HASH_SIZE + 1];
+    int i, j;
+
+    fill(data, sizeof(data), 0);
+
+    // the digest doesn't depend on how the message is fed
+    for (i = 0; i < ARRAY_SIZE(md5_boundaries); i++) {
+        for (j = 0; j < ARRAY_SIZE(steps); j++) {
+            digest(data, md5_boundaries[i].len, steps[j], out);
+            hex(out, str);
+            KUNIT_EXPECT_STREQ_MSG(test, str, md5_boundaries[i].md5, "%zu bytes, %zu at a time",
+                                   md5_boundaries[i].len, steps[j]);
+        }
+    }
+}
+
+static struct kunit_case mpc_md5_cases[] = {
+    KUNIT_CASE(mpc_md5_vectors),
+    KUNIT_CASE(mpc_md5_boundaries),
+    {}
+};
+
+static struct kunit_suite mpc_md5_suite = {
+    .name = "mpc-md5",
+    .test_cases = mpc_md5_cases,
+};
+
+// *****************************************************************************
+// *                            RTC                                            *
+// *****************************************************************************
+
+static void mpc_rtc_bcd(struct kunit *test) {
+    unsigned char bcd;
+    int n;
+
+    KUNIT_EXPECT_EQ(test, BCD2BIN(0x00), 0);
+    KUNIT_EXPECT_EQ(test, BCD2BIN(0x09), 9);
+    KUNIT_EXPECT_EQ(test, BCD2BIN(0x10), 10);
+    KUNIT_EXPECT_EQ(test, BCD2BIN(0x59), 59);
+    KUNIT_EXPECT_EQ(test, BCD2BIN(0x99), 99);
+
+    // every two digit value, as the CMOS registers hold them
+    for (n = 0; n < 100; n++) {
+        bcd = (n / 10) << 4 | n % 10;
+        KUNIT_EXPECT_EQ(test, BCD2BIN(bcd), n);
+    }
+}
+
+static struct kunit_case mpc_rtc_cases[] = {
+    KUNIT_CASE(mpc_rtc_bcd),
+    {}
+};
+
+static struct kunit_suite mpc_rtc_suite = {
+    .name = "mpc-rtc",
+    .test_cases = mpc_rtc_cases,
+};
+
+// *****************************************************************************
+// *                            STATS                                          *
+// *****************************************************************************
+
+static u64 stat_count(enum mpc_stat stat) {
+    struct mpc_hist hist;
+    u64 count = 0;
+    int b;
+
+    mpc_stat_sum(stat, &hist);
+    for (b = 0; b < MPC_STAT_BUCKETS; b++)
+        count += hist.buckets[b];
+    return count;
+}
+
+static void mpc_stats_record(struct kunit *test) {
+    int i;
+
+    mpc_stats_write(NULL, NULL, 1, NULL);
+    KUNIT_EXPECT_EQ(test, stat_count(MPC_STAT_RTC_READ), 0ULL);
+
+    for (i = 0; i < 100; i++)
+        mpc_stat_add(MPC_STAT_RTC_READ, ktime_get_ns());
+    KUNIT_EXPECT_EQ(test, stat_count(MPC_STAT_RTC_READ), 100ULL);
+    KUNIT_EXPECT_EQ(test, stat_count(MPC_STAT_MD5_HASH), 0ULL);
+
+    // any write resets
+    mpc_stats_write(NULL, NULL, 1, NULL);
+    KUNIT_EXPECT_EQ(test, stat_count(MPC_STAT_RTC_READ), 0ULL);
+}
+
+static void mpc_stats_percentiles(struct kunit *test) {
+    struct mpc_hist hist = {};
+
+    // 900 under 1 us, 90 under 1 ms, 9 under 16 ms, 1 under 1 s
+    hist.buckets[10] = 900;
+    hist.buckets[20] = 90;
+    hist.buckets[24] = 9;
+    hist.buckets[30] = 1;
+
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 1000, 500), 1ULL << 10);
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 1000, 900), 1ULL << 10);
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 1000, 990), 1ULL << 20);
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 1000, 999), 1ULL << 24);
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 1000, 1000), 1ULL << 30);
+    KUNIT_EXPECT_EQ(test, mpc_stat_percentile(&hist, 0, 500), 0ULL);
+}
+
+static struct kunit_case mpc_stats_cases[] = {
+    KUNIT_CASE(mpc_stats_record),
+    KUNIT_CASE(mpc_stats_percentiles),
+    {}
+};
+
+static struct kunit_suite mpc_stats_suite = {
+    .name = "mpc-stats",
+    .test_cases = mpc_stats_cases,
+};
+
+kunit_test_suites(&mpc_stack_suite, &mpc_md5_suite, &mpc_rtc_suite, &mpc_stats_suite);
+
+MODULE_LICENSE("GPL");
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Run the KUnit suite under User-Mode Linux.
+# usage: run.sh <kernel source tree> [kunit.py run options]
+
+set -e
+
+KDIR=${1:?usage: $0 <kernel source tree> [kunit.py run options]}
+shift
+REPO=$(cd "$(dirname "$0")/../.." && pwd)
+
+# hook the repository into drivers/misc, once
+ln -sfn "$REPO" "$KDIR/drivers/misc/mpc"
+grep -q 'drivers/misc/mpc/' "$KDIR/drivers/misc/Kconfig" ||
+    sed -i '$i source "drivers/misc/mpc/test/kunit/Kconfig"' "$KDIR/drivers/misc/Kconfig"
+grep -q 'mpc/test/kunit/' "$KDIR/drivers/misc/Makefile" ||
+    echo 'obj-$(CONFIG_MPC_KUNIT_TEST) += mpc/test/kunit/' >> "$KDIR/drivers/misc/Makefile"
+
+cd "$KDIR"
+exec ./tools/testing/kunit/kunit.py run --kunitconfig=drivers/misc/mpc/test/kunit "$@"
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Copyright 2020 José María Cruz Lorite
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+# Measure load time and kernel memory of the driver for several stack
+# counts. Must run as root with the driver unloaded.
+#
+#   ./load_bench.sh [path/to/mpc.ko] [counts...]
+#
+# One JSON object is printed per count.
+
+KO=${1:-../../mpc/mpc.ko}
+[ $# -gt 0 ] && shift
+COUNTS=${*:-1000 10000 100000}
+
+# kernel memory in kB: slab + vmalloc + page tables
+kmem() {
+    awk '/^(Slab|VmallocUsed|PageTables):/ { kb += $2 } END { print kb }' /proc/meminfo
+}
+
+now_ns() {
+    date +%s%N
+}
+
+for n in $COUNTS; do
+    sync
+    echo 3 > /proc/sys/vm/drop_caches
+    mem0=$(kmem)
+
+    t0=$(now_ns)
+    insmod "$KO" stacks="$n" max_stacks="$n" || exit 1
+    t1=$(now_ns)
+    udevadm settle
+    t2=$(now_ns)
+    mem1=$(kmem)
+
+    # open every stack once, so its state gets allocated
+    i=0
+    while [ $i -lt "$n" ]; do
+        : < /dev/stack$i
+        i=$((i + 1))
+    done
+    mem2=$(kmem)
+
+    t3=$(now_ns)
+    rmmod mpc
+    t4=$(now_ns)
+
+    printf '{"stacks": %d, "insmod_ms": %d, "udev_settle_ms": %d, "rmmod_ms": %d, ' \
+        "$n" $(((t1 - t0) / 1000000)) $(((t2 - t1) / 1000000)) $(((t4 - t3) / 1000000))
+    printf '"idle_kb": %d, "opened_kb": %d}\n' $((mem1 - mem0)) $((mem2 - mem0))
+done
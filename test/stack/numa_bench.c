@@ -0,0 +1,221 @@
+// Copyright 2020 José María Cruz Lorite
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>                  // open
+#include <unistd.h>                 // read, write, pread
+#include <sched.h>                  // sched_setaffinity
+#include <libgen.h>                 // basename
+#include <sys/ioctl.h>              // ioctl
+#include <sys/syscall.h>            // syscall
+#include <linux/perf_event.h>       // perf_event_attr
+
+#define MB (1024.0 * 1024.0)
+
+static char *device = "/dev/stack0";
+static int   cpu = 0;               // cpu to run on
+static int   node = -2;             // buffer node, -2 leaves it as is
+static long  depth = 256L << 20;    // bytes on the stack under the test
+static long  size = 4096;           // bytes per operation
+static long  ops = 100000;          // operations per test
+
+/**
+ * Current time in nanoseconds.
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Open a counter of data TLB read misses (user and kernel) for this thread.
+ * Return -1 when perf is not available.
+ */
+static int dtlb_open(void) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void dtlb_start(int fd) {
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static long long dtlb_stop(int fd) {
+    long long count = -1;
+
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+    }
+    return count;
+}
+
+/**
+ * Print one test result as a JSON object.
+ */
+static void report(const char *name, double ns, long long misses, int last) {
+    printf("  \"%s\": {\"ops_per_s\": %.0f, \"mb_per_s\": %.1f, \"ns_per_op\": %.0f, ",
+           name, ops / (ns / 1e9), ops * size / MB / (ns / 1e9), ns / ops);
+    if (misses < 0)
+        printf("\"dtlb_misses_per_op\": null}");
+    else
+        printf("\"dtlb_misses_per_op\": %.2f}", (double) misses / ops);
+    printf("%s\n", last ? "" : ",");
+}
+
+/**
+ * Pin the stack buffer to 'node' through sysfs.
+ */
+static void set_node(void) {
+    char path[256], *dev = strdup(device);
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/sys/class/mpc_class/%s/numa_node", basename(dev));
+    free(dev);
+
+    if (!(f = fopen(path, "w")) || fprintf(f, "%d\n", node) < 0 || fclose(f)) {
+        printf("Error writing %s\n", path);
+        exit(1);
+    }
+}
+
+/**
+ * The 'huge_buffers' module parameter: 1, 0, or -1 when unknown.
+ */
+static int huge_buffers(void) {
+    FILE *f = fopen("/sys/module/mpc/parameters/huge_buffers", "r");
+    int c = -1;
+
+    if (f) {
+        c = fgetc(f);
+        fclose(f);
+    }
+    return c == 'Y' ? 1 : c == 'N' ? 0 : -1;
+}
+
+/**
+ * Push/pop and random peek throughput of a deep stack, from one CPU.
+ */
+int main(int argc, char **argv) {
+    unsigned int run_cpu, run_node;
+    long long misses;
+    cpu_set_t set;
+    double t;
+    char *buf;
+    long i, n;
+    int fd, pfd, opt;
+
+    while ((opt = getopt(argc, argv, "d:c:m:D:s:n:")) != -1) {
+        switch (opt) {
+            case 'd': device = optarg;              break;
+            case 'c': cpu = atoi(optarg);           break;
+            case 'm': node = atoi(optarg);          break;
+            case 'D': depth = atol(optarg);         break;
+            case 's': size = atol(optarg);          break;
+            case 'n': ops = atol(optarg);           break;
+            default:
+                printf("usage: %s [-d device] [-c cpu] [-m node] [-D depth] [-s size] [-n ops]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        printf("Error pinning to cpu %d\n", cpu);
+        exit(1);
+    }
+    syscall(SYS_getcpu, &run_cpu, &run_node, NULL);
+
+    fd = open(device, O_RDWR);
+    if (fd < 0) {
+        printf("Error opening %s\n", device);
+        exit(1);
+    }
+
+    if (node != -2)
+        set_node();
+
+    buf = malloc(size > (1 << 20) ? size : (1 << 20));
+    memset(buf, 0xA5, size > (1 << 20) ? size : (1 << 20));
+
+    // fill the stack under the test
+    for (n = 0; n < depth; n += 1 << 20)
+        if (write(fd, buf, depth - n < (1 << 20) ? depth - n : (1 << 20)) < 0) {
+            printf("Error filling %s\n", device);
+            exit(1);
+        }
+
+    pfd = dtlb_open();
+
+    printf("{\n  \"device\": \"%s\", \"cpu\": %u, \"cpu_node\": %u, \"buffer_node\": %d,\n",
+           device, run_cpu, run_node, node == -2 ? -1 : node);
+    printf("  \"depth\": %ld, \"size\": %ld, \"ops\": %ld, \"huge_buffers\": %d,\n", depth, size, ops, huge_buffers());
+
+    // push and pop at the top: touches the same few pages
+    dtlb_start(pfd);
+    t = now_ns();
+    for (i = 0; i < ops; i++) {
+        if (write(fd, buf, size) != size || read(fd, buf, size) != size) {
+            printf("Error on push/pop\n");
+            exit(1);
+        }
+    }
+    t = now_ns() - t;
+    misses = dtlb_stop(pfd);
+    report("push_pop", t, misses, 0);
+
+    // peek at random depths: touches the whole buffer
+    srand(1);
+    dtlb_start(pfd);
+    t = now_ns();
+    for (i = 0; i < ops; i++) {
+        if (pread(fd, buf, size, ((long) rand() * size) % (depth - size + 1)) != size) {
+            printf("Error on peek\n");
+            exit(1);
+        }
+    }
+    t = now_ns() - t;
+    misses = dtlb_stop(pfd);
+    report("peek_random", t, misses, 1);
+    printf("}\n");
+
+    // leave the stack empty
+    while (read(fd, buf, 1 << 20) > 0)
+        ;
+
+    free(buf);
+    close(fd);
+    return 0;
+}